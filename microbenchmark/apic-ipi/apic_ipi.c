@@ -6,14 +6,23 @@
 #include <linux/delay.h>
 #include <asm/irq_vectors.h>
 #include <linux/kallsyms.h>
+#include <asm/smp.h>
+#include <linux/topology.h>
+#include <linux/nodemask.h>
+#include <linux/slab.h>
 #include <asm/apic.h>
 #include "../common/rdtsc.h"
 
 static int options;
 module_param(options, int, 0444);
 
+/* also sweep mask size 1, 2, 4 ... all the CPUs */
+static int sweep;
+module_param(sweep, int, 0444);
+
 #define LOOP 100000
-#define MAXNUMA 4
+#define SWEEP_LOOP 10000
+#define MAXNUMA 8
 
 static char *ipi_funcs[] = {
 	"kvm_send_ipi_mask",
@@ -22,58 +31,279 @@ static char *ipi_funcs[] = {
 	"x2apic_send_IPI_mask",
 };
 
-static void bench(char *func, int nodes)
+#define NR_FUNCS (sizeof(ipi_funcs) / sizeof(ipi_funcs[0]))
+
+/* destinations by distance from current CPU: SMT sibling, LLC, node, each remote node */
+#define TARGET_SMT	0
+#define TARGET_LLC	1
+#define TARGET_NODE	2
+#define TARGET_REMOTE	3
+#define MAXTARGETS	(TARGET_REMOTE + MAXNUMA)
+
+struct ipi_target {
+	char name[16];
+	int cpu;	/* -1 if no such CPU */
+};
+
+static struct ipi_target targets[MAXTARGETS];
+static int nr_targets;
+
+/* average cycles of each function to each target, 0 if not run */
+static unsigned long results[NR_FUNCS][MAXTARGETS];
+
+typedef void (*send_IPI_mask_t)(const struct cpumask *mask, int vector);
+
+/*
+ * the CPUs sharing the last level cache with cpu, NULL if unknown.
+ * get_cpu_cacheinfo() isn't exported, the x86 topology map is.
+ */
+static const struct cpumask *llc_mask(int cpu)
+{
+	const struct cpumask *llc = cpu_llc_shared_mask(cpu);
+
+	return cpumask_empty(llc) ? NULL : llc;
+}
+
+/* pick the first CPU in mask, but not in any closer class */
+static int pick_target(const struct cpumask *mask, int currentcpu, const struct cpumask *closer)
+{
+	int cpu;
+
+	for_each_cpu(cpu, mask) {
+		if ((cpu == currentcpu) || !cpu_online(cpu))
+			continue;
+
+		if (closer && cpumask_test_cpu(cpu, closer))
+			continue;
+
+		return cpu;
+	}
+
+	return -1;
+}
+
+static void build_targets(int currentcpu)
+{
+	const struct cpumask *smt = topology_sibling_cpumask(currentcpu);
+	const struct cpumask *llc = llc_mask(currentcpu);
+	int node = cpu_to_node(currentcpu), remote;
+	struct ipi_target *t;
+
+	nr_targets = 0;
+
+	t = &targets[nr_targets++];
+	snprintf(t->name, sizeof(t->name), "smt");
+	t->cpu = pick_target(smt, currentcpu, NULL);
+
+	t = &targets[nr_targets++];
+	snprintf(t->name, sizeof(t->name), "llc");
+	t->cpu = llc ? pick_target(llc, currentcpu, smt) : -1;
+
+	t = &targets[nr_targets++];
+	snprintf(t->name, sizeof(t->name), "node%d", node);
+	t->cpu = pick_target(cpumask_of_node(node), currentcpu, llc ? llc : smt);
+
+	for_each_online_node(remote) {
+		if (remote == node)
+			continue;
+
+		if (nr_targets == MAXTARGETS) {
+			printk(KERN_INFO "apic_ipi: more than %d remote nodes, ignore the others\n", MAXNUMA);
+			break;
+		}
+
+		t = &targets[nr_targets++];
+		snprintf(t->name, sizeof(t->name), "node%d", remote);
+		t->cpu = pick_target(cpumask_of_node(remote), currentcpu, NULL);
+	}
+}
+
+/* average cycles of sending IPI to mask */
+static unsigned long bench_mask(send_IPI_mask_t send_IPI_mask, const struct cpumask *mask, int loops)
 {
 	unsigned long start, end;
-	int loop, node;
-	unsigned int currentcpu, targetcpu;
-	unsigned char numa[MAXNUMA] = {0};
-	void (*send_IPI_mask)(const struct cpumask *mask, int vector);
+	int loop;
 
-	send_IPI_mask = (void (*)(const struct cpumask *mask, int vector))kallsyms_lookup_name(func);
+	start = ins_rdtsc();
+	for (loop = 0; loop < loops; loop++) {
+		send_IPI_mask(mask, CALL_FUNCTION_SINGLE_VECTOR);
+	}
+	end = ins_rdtsc();
+
+	return (end - start) / loops;
+}
+
+static void bench(int idx)
+{
+	char *func = ipi_funcs[idx];
+	unsigned int currentcpu;
+	send_IPI_mask_t send_IPI_mask;
+	struct ipi_target *t;
+	int i;
+
+	send_IPI_mask = (send_IPI_mask_t)kallsyms_lookup_name(func);
+	if (!send_IPI_mask) {
+		printk(KERN_INFO "apic_ipi: %s not found, skip\n", func);
+		return;
+	}
 
 	currentcpu = get_cpu();
 
-	/* from current cpu to each NUMA node IPI */
-	for (node = 0; node < nodes && node < MAXNUMA; node++) {
-		for_each_online_cpu(targetcpu) {
-			if (targetcpu == currentcpu)
-				continue;
+	for (i = 0; i < nr_targets; i++) {
+		t = &targets[i];
+		if (t->cpu < 0)
+			continue;
+
+		printk(KERN_INFO "apic_ipi: 	IPI[%s] from CPU[%d] to CPU[%d] [%s]\n", func, currentcpu, t->cpu, t->name);
+		results[idx][i] = bench_mask(send_IPI_mask, cpumask_of(t->cpu), LOOP);
+		printk(KERN_INFO "apic_ipi:		avg %ld cycles\n", results[idx][i]);
+	}
+
+	put_cpu();
+}
+
+#define SPREAD_COMPACT	0
+#define SPREAD_SCATTER	1
 
-			if (numa[cpu_to_node(targetcpu)])
-				continue;
+static char *spreads[] = { "compact", "scatter" };
 
+/* add the CPUs of from to mask until it has count CPUs */
+static int fill_mask(struct cpumask *mask, const struct cpumask *from, int currentcpu, int count)
+{
+	int cpu, picked = cpumask_weight(mask);
+
+	for_each_cpu(cpu, from) {
+		if (picked == count)
 			break;
-		}
 
+		if ((cpu == currentcpu) || !cpu_online(cpu) || cpumask_test_cpu(cpu, mask))
+			continue;
 
-		printk(KERN_INFO "apic_ipi: 	IPI[%s] from CPU[%d] to CPU[%d]\n", func, currentcpu, targetcpu);
+		cpumask_set_cpu(cpu, mask);
+		picked++;
+	}
 
-		start = ins_rdtsc();
-		for (loop = 0; loop < LOOP; loop++) {
-			send_IPI_mask(cpumask_of(targetcpu), CALL_FUNCTION_SINGLE_VECTOR);
+	return picked;
+}
+
+/*
+ * compact: the nearest CPUs first, SMT siblings, LLC, node, then the others.
+ * scatter: one CPU from each node in turn.
+ */
+static int build_mask(struct cpumask *mask, int currentcpu, int count, int spread)
+{
+	const struct cpumask *llc = llc_mask(currentcpu);
+	int node, picked = 0, last;
+
+	cpumask_clear(mask);
+
+	if (spread == SPREAD_COMPACT) {
+		fill_mask(mask, topology_sibling_cpumask(currentcpu), currentcpu, count);
+		if (llc)
+			fill_mask(mask, llc, currentcpu, count);
+		fill_mask(mask, cpumask_of_node(cpu_to_node(currentcpu)), currentcpu, count);
+
+		return fill_mask(mask, cpu_online_mask, currentcpu, count);
+	}
+
+	do {
+		last = picked;
+		for_each_online_node(node) {
+			if (picked < count)
+				picked = fill_mask(mask, cpumask_of_node(node), currentcpu, picked + 1);
 		}
-		end = ins_rdtsc();
+	} while ((picked < count) && (picked != last));
+
+	return picked;
+}
+
+static int mask_nodes(const struct cpumask *mask)
+{
+	nodemask_t nodes = NODE_MASK_NONE;
+	int cpu;
+
+	for_each_cpu(cpu, mask)
+		node_set(cpu_to_node(cpu), nodes);
+
+	return nodes_weight(nodes);
+}
+
+/* cycles per call and per destination for mask size 1, 2, 4 ... all the CPUs */
+static void bench_sweep(int idx, struct cpumask *mask)
+{
+	char *func = ipi_funcs[idx];
+	send_IPI_mask_t send_IPI_mask;
+	unsigned int currentcpu;
+	unsigned long cycles;
+	int spread, count, dests, max = num_online_cpus() - 1;
+
+	send_IPI_mask = (send_IPI_mask_t)kallsyms_lookup_name(func);
+	if (!send_IPI_mask)
+		return;
+
+	currentcpu = get_cpu();
 
-		printk(KERN_INFO "apic_ipi:		total cycles %ld, avg %ld\n", end - start, (end - start) / LOOP);
+	for (spread = SPREAD_COMPACT; spread <= SPREAD_SCATTER; spread++) {
+		/* the last round covers all the CPUs */
+		for (count = 1; count <= max; count = min(count * 2, max)) {
+			dests = build_mask(mask, currentcpu, count, spread);
+			cycles = bench_mask(send_IPI_mask, mask, SWEEP_LOOP);
+			printk(KERN_INFO "apic_ipi: %-40s %-8s dests %4d nodes %d: %8ld cycles/call %8ld cycles/dest\n",
+					func, spreads[spread], dests, mask_nodes(mask), cycles, cycles / dests);
 
-		numa[cpu_to_node(targetcpu)] = 1;
+			if (count >= max)
+				break;
+		}
 	}
 
 	put_cpu();
 }
 
+static void report(void)
+{
+	char line[512];
+	int i, t, len;
+
+	len = snprintf(line, sizeof(line), "%-40s", "cycles");
+	for (t = 0; t < nr_targets; t++) {
+		len += snprintf(line + len, sizeof(line) - len, " %10s", targets[t].name);
+	}
+	printk(KERN_INFO "apic_ipi: %s\n", line);
+
+	len = snprintf(line, sizeof(line), "%-40s", "target CPU");
+	for (t = 0; t < nr_targets; t++) {
+		len += snprintf(line + len, sizeof(line) - len, " %10d", targets[t].cpu);
+	}
+	printk(KERN_INFO "apic_ipi: %s\n", line);
+
+	for (i = 0; i < NR_FUNCS; i++) {
+		if (!(options & (1 << i)))
+			continue;
+
+		len = snprintf(line, sizeof(line), "%-40s", ipi_funcs[i]);
+		for (t = 0; t < nr_targets; t++) {
+			if (results[i][t])
+				len += snprintf(line + len, sizeof(line) - len, " %10ld", results[i][t]);
+			else
+				len += snprintf(line + len, sizeof(line) - len, " %10s", "-");
+		}
+		printk(KERN_INFO "apic_ipi: %s\n", line);
+	}
+}
+
 static int apic_ipi_init(void)
 {
 	int nodes = num_online_nodes();
 	char name[KSYM_NAME_LEN];
+	cpumask_var_t mask;
 	int i;
 
 	if (!options) {
 		printk(KERN_INFO "apic_ipi: you should run insmod apic_ipi.ko options=XX, bit flags:\n");
-		for (i = 0; i < sizeof(ipi_funcs) / sizeof(ipi_funcs[0]); i++) {
+		for (i = 0; i < NR_FUNCS; i++) {
 			printk(KERN_INFO "apic_ipi:	bit[%d] %s\n", i, ipi_funcs[i]);
 		}
+		printk(KERN_INFO "apic_ipi: use sweep=1 to also sweep mask size 1, 2, 4 ... all the CPUs\n");
 
 		return -1;
 	}
@@ -93,11 +323,32 @@ static int apic_ipi_init(void)
 		printk(KERN_INFO "apic_ipi: apic->send_IPI_mask[%lx]\n", (unsigned long)apic->send_IPI_mask);
 	}
 
-	for (i = 0; i < sizeof(ipi_funcs) / sizeof(ipi_funcs[0]); i++) {
+	/* targets are picked from the loading CPU, stay on it */
+	build_targets(get_cpu());
+	for (i = 0; i < NR_FUNCS; i++) {
 		if (options & (1 << i)) {
-			bench(ipi_funcs[i], nodes);
+			bench(i);
 		}
 	}
+	put_cpu();
+
+	report();
+
+	if (!sweep)
+		return -1;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+		printk(KERN_INFO "apic_ipi: no enough memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < NR_FUNCS; i++) {
+		if (options & (1 << i)) {
+			bench_sweep(i, mask);
+		}
+	}
+
+	free_cpumask_var(mask);
 
 	return -1;
 }
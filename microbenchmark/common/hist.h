@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2021 zhenwei pi pizhenwei@bytedance.com.
+ */
+#ifndef __HIST_H__
+#define __HIST_H__
+
+/*
+ * log-linear histogram, usable by both kernel modules and userspace tools.
+ * each power of two is split into HIST_SUB_BUCKETS linear buckets, so the
+ * relative error of a reported percentile is less than 1/HIST_SUB_BUCKETS.
+ */
+#define HIST_SUB_BITS		3
+#define HIST_SUB_BUCKETS	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS		((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct hist {
+	unsigned long count[HIST_BUCKETS];
+	unsigned long total;
+	unsigned long sum;
+	unsigned long min;
+	unsigned long max;
+};
+
+static inline int hist_index(unsigned long val)
+{
+	int shift;
+
+	if (val < HIST_SUB_BUCKETS)
+		return val;
+
+	shift = 63 - __builtin_clzl(val) - HIST_SUB_BITS;
+
+	return ((shift + 1) << HIST_SUB_BITS) + ((val >> shift) & (HIST_SUB_BUCKETS - 1));
+}
+
+/* the lower bound of values which fall into bucket idx */
+static inline unsigned long hist_value(int idx)
+{
+	int shift;
+
+	if (idx < HIST_SUB_BUCKETS)
+		return idx;
+
+	shift = (idx >> HIST_SUB_BITS) - 1;
+
+	return (unsigned long)(HIST_SUB_BUCKETS | (idx & (HIST_SUB_BUCKETS - 1))) << shift;
+}
+
+static inline void hist_add(struct hist *h, unsigned long val)
+{
+	h->count[hist_index(val)]++;
+	if (!h->total || val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+	h->total++;
+	h->sum += val;
+}
+
+static inline void hist_merge(struct hist *dst, const struct hist *src)
+{
+	int idx;
+
+	if (!src->total)
+		return;
+
+	for (idx = 0; idx < HIST_BUCKETS; idx++)
+		dst->count[idx] += src->count[idx];
+
+	if (!dst->total || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->total += src->total;
+	dst->sum += src->sum;
+}
+
+static inline unsigned long hist_avg(const struct hist *h)
+{
+	return h->total ? h->sum / h->total : 0;
+}
+
+/* pct in [0, 100] */
+static inline unsigned long hist_percentile(const struct hist *h, int pct)
+{
+	unsigned long target, seen = 0, val;
+	int idx;
+
+	if (!h->total)
+		return 0;
+
+	if (pct >= 100)
+		return h->max;
+
+	target = (h->total * pct + 99) / 100;
+	if (!target)
+		target = 1;
+
+	for (idx = 0; idx < HIST_BUCKETS; idx++) {
+		seen += h->count[idx];
+		if (seen >= target)
+			break;
+	}
+
+	val = hist_value(idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1);
+	if (val < h->min)
+		val = h->min;
+	if (val > h->max)
+		val = h->max;
+
+	return val;
+}
+
+#endif
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2021 zhenwei pi pizhenwei@bytedance.com.
+ */
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+/*
+ * run one benchmark function on many CPUs at the same time, kernel modules only.
+ * every worker is a kthread bound to its CPU. the workers spin to a common TSC
+ * deadline which is published after all of them get ready, so that they start
+ * together without wakeup delay. include hist.h and rdtsc.h before this file.
+ */
+#include <linux/kthread.h>
+#include <linux/vmalloc.h>
+#include <linux/delay.h>
+#include <linux/wait.h>
+
+#define PARALLEL_START_DELAY_US	1000
+
+struct parallel_worker {
+	int cpu;
+	void *arg;
+	unsigned long start;	/* TSC */
+	unsigned long finish;	/* TSC */
+	struct hist hist;	/* filled by the benchmark function */
+};
+
+typedef void (*parallel_fn)(struct parallel_worker *pw);
+
+/* the workers touch these after the coordinator returns, keep them static */
+static parallel_fn parallel_func;
+static atomic_t parallel_ready;
+static atomic_t parallel_done;
+static atomic_t parallel_abort;
+static atomic64_t parallel_start_tsc;
+static DECLARE_WAIT_QUEUE_HEAD(parallel_wq);
+
+static int parallel_task(void *data)
+{
+	struct parallel_worker *pw = data;
+	unsigned long deadline;
+
+	atomic_inc(&parallel_ready);
+	while (!(deadline = atomic64_read(&parallel_start_tsc))) {
+		if (atomic_read(&parallel_abort))
+			goto out;
+
+		cond_resched();
+		cpu_relax();
+	}
+
+	while (ins_rdtsc() < deadline)
+		cpu_relax();
+
+	pw->start = ins_rdtsc();
+	parallel_func(pw);
+	pw->finish = ins_rdtsc();
+
+out:
+	atomic_inc(&parallel_done);
+	wake_up(&parallel_wq);
+
+	return 0;
+}
+
+/*
+ * run fn on the first nr online CPUs, return the workers(freed by vfree) or
+ * NULL on error. nr is updated to the number of workers actually run.
+ */
+static struct parallel_worker *parallel_run(const char *name, int *nr, parallel_fn fn, void *arg)
+{
+	struct parallel_worker *workers;
+	struct task_struct *tsk;
+	int cpu, i = 0;
+
+	*nr = min_t(int, *nr, num_online_cpus());
+	workers = vzalloc(array_size(*nr, sizeof(*workers)));
+	if (!workers)
+		return NULL;
+
+	parallel_func = fn;
+	atomic_set(&parallel_ready, 0);
+	atomic_set(&parallel_done, 0);
+	atomic_set(&parallel_abort, 0);
+	atomic64_set(&parallel_start_tsc, 0);
+
+	for_each_online_cpu(cpu) {
+		if (i == *nr)
+			break;
+
+		workers[i].cpu = cpu;
+		workers[i].arg = arg;
+		tsk = kthread_create_on_node(parallel_task, &workers[i], cpu_to_node(cpu), "%s/%d", name, cpu);
+		if (IS_ERR(tsk)) {
+			printk(KERN_INFO "%s: create kthread failed\n", name);
+			atomic_set(&parallel_abort, 1);
+			break;
+		}
+
+		kthread_bind(tsk, cpu);
+		wake_up_process(tsk);
+		i++;
+	}
+
+	if (!atomic_read(&parallel_abort)) {
+		while (atomic_read(&parallel_ready) < i)
+			msleep(1);
+
+		atomic64_set(&parallel_start_tsc, ins_rdtsc() + tsc_khz * PARALLEL_START_DELAY_US / 1000);
+	}
+
+	/* the benchmark functions are bounded loops, no timeout here */
+	wait_event(parallel_wq, atomic_read(&parallel_done) == i);
+
+	if (atomic_read(&parallel_abort)) {
+		vfree(workers);
+		return NULL;
+	}
+
+	return workers;
+}
+
+/* per-CPU latency, and the aggregate throughput from the first start to the last finish */
+static void parallel_report(const char *name, const char *tag, struct parallel_worker *workers, int nr)
+{
+	struct hist *all;
+	unsigned long start = ULONG_MAX, finish = 0, window;
+	int i;
+
+	all = vzalloc(sizeof(*all));
+	if (!all)
+		return;
+
+	for (i = 0; i < nr; i++) {
+		struct hist *h = &workers[i].hist;
+
+		printk(KERN_INFO "%s: %s CPU[%3d] loop = %ld, average = %ld, p50 = %ld, p99 = %ld, max = %ld cycles\n",
+				name, tag, workers[i].cpu, h->total, hist_avg(h), hist_percentile(h, 50),
+				hist_percentile(h, 99), h->max);
+
+		hist_merge(all, h);
+		start = min(start, workers[i].start);
+		finish = max(finish, workers[i].finish);
+	}
+
+	window = finish > start ? finish - start : 1;
+	printk(KERN_INFO "%s: %s %d CPUs, loop = %ld, window = %ld cycles, throughput = %ld ops/s, "
+			"average = %ld, p50 = %ld, p99 = %ld, max = %ld cycles\n",
+			name, tag, nr, all->total, window, all->total * tsc_khz * 1000 / window,
+			hist_avg(all), hist_percentile(all, 50), hist_percentile(all, 99), all->max);
+
+	vfree(all);
+}
+
+#endif
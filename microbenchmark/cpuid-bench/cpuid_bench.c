@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2021 zhenwei pi pizhenwei@bytedance.com.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <asm/processor.h>
+#include "../common/rdtsc.h"
+#include "../common/hist.h"
+
+/* one more leaf to benchmark, -1 means none */
+static long leaf = -1;
+module_param(leaf, long, 0444);
+
+static int subleaf;
+module_param(subleaf, int, 0444);
+
+#define LOOP 10000
+#define LEAF_MAX_BASIC	(~0U)	/* placeholder of max basic leaf + 1, unsupported */
+
+struct cpuid_case {
+	char *name;
+	unsigned int leaf;
+	unsigned int subleaf;
+};
+
+static struct cpuid_case cases[] = {
+	{ "vendor", 0x0, 0 },
+	{ "feature", 0x1, 0 },
+	{ "extended feature", 0x7, 0 },
+	{ "topology SMT", 0xb, 0 },
+	{ "topology core", 0xb, 1 },
+	{ "hypervisor signature", 0x40000000, 0 },
+	{ "hypervisor feature", 0x40000001, 0 },
+	{ "unsupported basic", LEAF_MAX_BASIC, 0 },
+	{ "unsupported hypervisor", 0x4fffff00, 0 },
+};
+
+/* cost of the rdtsc pair itself, subtracted from each iteration */
+static unsigned long cpuid_bench_overhead(void)
+{
+	unsigned long start, min = ULONG_MAX;
+	int loop;
+
+	for (loop = LOOP; loop > 0; loop--) {
+		start = ins_rdtsc();
+		min = min(min, ins_rdtsc() - start);
+	}
+
+	return min;
+}
+
+static void cpuid_bench(struct hist *h, char *name, unsigned int op, unsigned int count, unsigned long overhead)
+{
+	unsigned int eax, ebx, ecx, edx;
+	unsigned long start, cycles, flags;
+	int loop;
+
+	memset(h, 0, sizeof(*h));
+
+	/* no interrupt in the middle, LOOP * a few us is short enough */
+	local_irq_save(flags);
+	for (loop = LOOP; loop > 0; loop--) {
+		start = ins_rdtsc();
+		cpuid_count(op, count, &eax, &ebx, &ecx, &edx);
+		cycles = ins_rdtsc() - start;
+		hist_add(h, cycles > overhead ? cycles - overhead : 0);
+	}
+	local_irq_restore(flags);
+
+	printk(KERN_INFO "cpuid_bench: %-24s leaf 0x%08x subleaf %u, loop = %d, average = %ld, "
+			"p50 = %ld, p90 = %ld, p99 = %ld, min = %ld, max = %ld cycles\n",
+			name, op, count, LOOP, hist_avg(h), hist_percentile(h, 50), hist_percentile(h, 90),
+			hist_percentile(h, 99), h->min, h->max);
+}
+
+static int cpuid_bench_init(void)
+{
+	struct hist *h;
+	unsigned long overhead;
+	unsigned int op;
+	int i;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h) {
+		printk(KERN_INFO "cpuid_bench: no enough memory\n");
+		return -1;
+	}
+
+	printk(KERN_INFO "cpuid_bench: %s start, running on %s\n", __func__,
+			boot_cpu_has(X86_FEATURE_HYPERVISOR) ? "guest" : "bare metal");
+
+	preempt_disable();
+	overhead = cpuid_bench_overhead();
+	printk(KERN_INFO "cpuid_bench: rdtsc overhead = %ld cycles, subtracted\n", overhead);
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		op = cases[i].leaf;
+		if (op == LEAF_MAX_BASIC)
+			op = cpuid_eax(0) + 1;
+
+		cpuid_bench(h, cases[i].name, op, cases[i].subleaf, overhead);
+	}
+
+	if (leaf >= 0)
+		cpuid_bench(h, "user specified", (unsigned int)leaf, subleaf, overhead);
+	preempt_enable();
+
+	printk(KERN_INFO "cpuid_bench: %s finish\n", __func__);
+	kfree(h);
+
+	return -1;
+}
+
+static void cpuid_bench_exit(void)
+{
+	/* should never run */
+	printk(KERN_INFO "cpuid_bench: %s\n", __func__);
+}
+
+module_init(cpuid_bench_init);
+module_exit(cpuid_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("zhenwei pi pizhewnei@bytedance.com");
@@ -7,14 +7,28 @@
 #include <linux/wait.h>
 #include <linux/slab.h>
 #include <linux/random.h>
+#include <linux/delay.h>
+#include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/nodemask.h>
+#include <linux/version.h>
+#include <asm/tsc.h>
+#include <asm/special_insns.h>
 #include "../common/rdtsc.h"
 #include "../common/getns.h"
+#include "../common/hist.h"
 
 static inline long unsigned gettime(void)
 {
 	return getns();
 }
 
+static inline unsigned long cycles_to_ns(unsigned long cycles)
+{
+	return tsc_khz ? cycles * 1000000UL / tsc_khz : cycles;
+}
+
 static int loops = 1000000;
 module_param(loops, int, 0444);
 
@@ -39,14 +53,67 @@ module_param(wait, int, 0444);
 static int __read_mostly lock = 1;
 module_param(lock, int, 0444);
 
+static int __read_mostly payload = -1;
+module_param(payload, int, 0444);
+
+static int __read_mostly lines = 8;
+module_param(lines, int, 0444);
+
+static int remotemb = 64;
+module_param(remotemb, int, 0444);
+
+static int dests = -1;
+module_param(dests, int, 0444);
+
+static char *dstlist;
+module_param(dstlist, charp, 0444);
+
+static int spread = -1;
+module_param(spread, int, 0444);
+
+static int victimms = 1000;
+module_param(victimms, int, 0444);
+
+static int victimgap = 500;
+module_param(victimgap, int, 0444);
+
+static int rates[16] = { 0, 1000, 10000, 100000, 1000000 };
+static int nr_rates = 5;
+module_param_array(rates, int, &nr_rates, 0444);
+
 static int options;
 module_param(options, int, 0444);
 
+/* an iteration slower than outlier * the fastest one is treated as disturbed */
+static int outlier = 4;
+module_param(outlier, int, 0444);
+
+/* run each case for durationms instead of loops, calibrated by a pilot run */
+static int durationms;
+module_param(durationms, int, 0444);
+
+/* target 95% confidence interval of AVG call in permille, for durationms */
+static int ci = 10;
+module_param(ci, int, 0444);
+
+static int warmup = 1000;
+module_param(warmup, int, 0444);
+
+/* stop the workers and report partial statistics after timeoutms */
 static unsigned long timeoutms = 10000;
+module_param(timeoutms, ulong, 0444);
+
+#define PILOT_LOOPS	1000
+
+/* workers start at a TSC deadline this far after the last one gets ready */
+#define START_DELAY_US	1000
 
 static atomic64_t ready_to_run;
 static atomic64_t should_run;
 static atomic64_t complete_run;
+static atomic64_t start_tsc;	/* TSC deadline published by the coordinator */
+static atomic64_t start_abort;
+static atomic64_t stop_run;	/* the coordinator asks the workers to stop */
 
 static DECLARE_WAIT_QUEUE_HEAD(wait_complete);
 
@@ -54,17 +121,49 @@ static DECLARE_WAIT_QUEUE_HEAD(wait_complete);
 #define SINGLE_IPI	(1<<1)
 #define MESH_IPI	(1<<2)
 #define ALL_IPI		(1<<3)
+#define MULTICAST_IPI	(1<<4)
+#define RECEIVER_IPI	(1<<5)
+
+#define PAYLOAD_EMPTY		0
+#define PAYLOAD_SPINLOCK	1
+#define PAYLOAD_ATOMIC		2
+#define PAYLOAD_PERCPU		3
+#define PAYLOAD_FALSESHARE	4
+#define PAYLOAD_CACHELINES	5
+#define PAYLOAD_REMOTE		6
+#define PAYLOAD_TLBFLUSH	7
+
+static char *payloads[] = {
+	"empty: do nothing.",
+	"spinlock: take a spin lock shared by all the CPUs(same as lock=1).",
+	"atomic: increase an atomic counter shared by all the CPUs.",
+	"percpu: increase a per-CPU counter.",
+	"falseshare: increase a counter of this CPU, the counters of all the CPUs are packed in a few cachelines.",
+	"cachelines: write lines=XX(default 8) cachelines shared by all the CPUs.",
+	"remote: read lines=XX cachelines from a remotemb=XX MB(default 64) buffer on the next NUMA node.",
+	"tlbflush: flush local TLB by reloading CR3, like flush_tlb_local().",
+};
+
+#define SPREAD_COMPACT	0
+#define SPREAD_SCATTER	1
 
 static char *benchcases[] = {
 	"self-ipi: send ipi to self, you can specify CPU by param srccpu=XX(default current CPU).",
 	"single-ipi: send ipi from srccpu=XX to dstcpu=YY(default different random XX and YY), wait=0/1 to specify wait or not.",
 	"mesh-ipi: send single ipi from one CPU to another CPU for all the CPUs, use pairs=XX to set number of benchmark pairs(default num_cpus / 2); use acrossnuma=0/1 to set IPI across NUMA(default = 1).",
-	"all-ipi: send ipi from one CPU to all the CPUs, use lock=0/1 to specify spin lock option in callback function; wait=0/1 to specify wait or not; use broadcasts=XX to set workers(default 1).",
+	"all-ipi: send ipi from one CPU to all the CPUs, use lock=0/1 to specify spin lock option in callback function, or payload=XX to select the callback function(see below); wait=0/1 to specify wait or not; use broadcasts=XX to set workers(default 1).",
+	"multicast-ipi: send ipi from srccpu=XX to a subset of CPUs, use dstlist=XX to specify the CPU list; or dests=XX to set the number of destinations(default sweep 1, 2, 4 ... all the CPUs); use spread=0/1 to pick destinations compact(from the nearest NUMA node) or scattered across NUMA nodes(default both); use lock=0/1, payload=XX and wait=0/1 as all-ipi.",
+	"receiver-ipi: send ipi from srccpu=XX to dstcpu=YY at each rate of rates=XX,YY...(ipi/s, 0 means no ipi, default 0,1000,10000,100000,1000000) for victimms=XX ms(default 1000), a victim kthread on dstcpu records the time stolen from it(gaps longer than victimgap=XX cycles, default 500), and dstcpu records the latency from sending to callback; wait=0/1 to specify wait or not.",
 };
 
 struct bench_args {
 	int src;		/* src CPU */
 	int dst;		/* dst CPU */
+	const struct cpumask *mask;	/* dst CPUs of broadcast/multicast */
+	int rate;		/* target ipi/s of receiver-ipi */
+	unsigned long sent;	/* ipi sent by receiver-ipi */
+	unsigned long stolen;	/* cycles stolen from the victim */
+	struct payload_ctx *ctx;	/* shared by the callbacks of broadcast/multicast */
 	atomic64_t forked;	/* forked timestamp */
 	atomic64_t start;	/* start to run timestamp */
 	atomic64_t finish;	/* finish bench timestamp */
@@ -72,6 +171,15 @@ struct bench_args {
 #ifdef CONFIG_SCHED_INFO
 	atomic64_t run_delay;	/* sched run delay */
 #endif
+	unsigned long skew;	/* cycles between start deadline and real start */
+	unsigned long loops;	/* loops to run, calibrated by durationms */
+	int stopped;		/* stopped by the coordinator, statistics are partial */
+	unsigned long fastest;	/* fastest iteration in cycles */
+	unsigned long clean;	/* iterations not disturbed */
+	unsigned long clean_cycles;
+	unsigned long clean_sq;	/* sum of squares of clean iterations */
+	unsigned long disturbed;	/* iterations preempted or interrupted */
+	struct hist hist;	/* per-iteration cycles, including disturbed ones */
 	char name[64];
 };
 
@@ -92,22 +200,122 @@ static void ipi_bench_gettime(void *info)
 	atomic64_set(info, diff);
 }
 
-static int ipi_bench_one(struct bench_args *ba)
+static inline unsigned long ipi_bench_csw(void)
+{
+	return current->nvcsw + current->nivcsw;
+}
+
+/*
+ * record one iteration, return true if it is disturbed: the task got scheduled
+ * out, or it took much longer than the fastest one which means an interrupt
+ * or a vCPU preemption happened in the middle.
+ */
+static bool ipi_bench_account(struct bench_args *ba, unsigned long cycles, bool preempted)
+{
+	hist_add(&ba->hist, cycles);
+	if (!ba->fastest || cycles < ba->fastest)
+		ba->fastest = cycles;
+
+	if (preempted || (cycles > ba->fastest * outlier)) {
+		ba->disturbed++;
+		return true;
+	}
+
+	ba->clean++;
+	ba->clean_cycles += cycles;
+	ba->clean_sq += cycles * cycles;
+
+	return false;
+}
+
+/* forget the iterations of warmup and pilot, but keep the fastest one */
+static void ipi_bench_clear(struct bench_args *ba)
+{
+	ba->clean = 0;
+	ba->clean_cycles = 0;
+	ba->clean_sq = 0;
+	ba->disturbed = 0;
+	atomic64_set(&ba->ipitime, 0);
+	memset(&ba->hist, 0, sizeof(ba->hist));
+}
+
+static unsigned long ipi_bench_stddev(struct bench_args *ba)
+{
+	unsigned long mean, sq;
+
+	if (!ba->clean)
+		return 0;
+
+	mean = ba->clean_cycles / ba->clean;
+	sq = ba->clean_sq / ba->clean;
+
+	return sq > mean * mean ? int_sqrt(sq - mean * mean) : 0;
+}
+
+/* the achieved 95% confidence interval of AVG call, in permille */
+static unsigned long ipi_bench_ci(struct bench_args *ba)
+{
+	unsigned long mean;
+
+	if (!ba->clean)
+		return 0;
+
+	mean = ba->clean_cycles / ba->clean;
+
+	return mean ? 2 * 1000 * ipi_bench_stddev(ba) / (mean * int_sqrt(ba->clean)) : 0;
+}
+
+/*
+ * by the pilot run, pick the loops to get the 95% confidence interval of the
+ * mean within ci permille, but never run longer than durationms.
+ */
+static unsigned long ipi_bench_calibrate(struct bench_args *ba)
+{
+	unsigned long mean, sd, n, limit;
+
+	if (!ba->clean || !hist_avg(&ba->hist))
+		return loops;
+
+	mean = ba->clean_cycles / ba->clean;
+	sd = ipi_bench_stddev(ba);
+	n = DIV_ROUND_UP(4 * 1000 * 1000 * sd * sd, (unsigned long)ci * ci * mean * mean);
+	limit = tsc_khz * (unsigned long)durationms / hist_avg(&ba->hist);
+
+	n = max_t(unsigned long, n, PILOT_LOOPS);
+	n = min(n, limit);
+
+	return n ? n : 1;
+}
+
+static inline bool ipi_bench_should_stop(unsigned long tsc, unsigned long end)
 {
-	unsigned long ipitime = 0, now;
-	int loop, ret, dst = ba->dst;
+	return (end && (tsc >= end)) || atomic64_read(&stop_run);
+}
+
+/* run n iterations, stop at TSC end(0 means no limit) or if the coordinator asks */
+static int ipi_bench_one(struct bench_args *ba, unsigned long n, unsigned long end)
+{
+	unsigned long ipitime = 0, now, csw, tsc;
+	int ret, dst = ba->dst;
+	bool disturbed;
+
+	while (n--) {
+		csw = ipi_bench_csw();
+		tsc = ins_rdtsc();
+		if (ipi_bench_should_stop(tsc, end))
+			break;
 
-	for (loop = loops; loop > 0; loop--) {
 		atomic64_set((atomic64_t *)&now, gettime());
 		ret = smp_call_function_single(dst, ipi_bench_gettime, &now, wait);
 		if (ret < 0)
 			return ret;
 
-		if (wait)
+		disturbed = ipi_bench_account(ba, ins_rdtsc() - tsc, csw != ipi_bench_csw());
+		if (wait && !disturbed)
 			ipitime += atomic64_read((const atomic64_t *)&now);
 	}
 
-	atomic64_set(&ba->ipitime, ipitime);
+	atomic64_add(ipitime, &ba->ipitime);
 
 	return 0;
 }
@@ -119,27 +327,99 @@ static void ipi_bench_record_run_delay(struct bench_args *ba)
 #endif
 }
 
+/* every exit of a worker counts, the worker never touches its data after this */
+static inline void ipi_bench_done(void)
+{
+	atomic64_add(1, (atomic64_t *)&complete_run);
+
+	wake_up_interruptible(&wait_complete);
+}
+
+static inline void ipi_bench_complete(struct bench_args *ba)
+{
+	atomic64_set(&ba->finish, gettime());
+	ipi_bench_record_run_delay(ba);
+	ipi_bench_done();
+}
+
+typedef int (*ipi_bench_fn)(struct bench_args *ba, unsigned long n, unsigned long end);
+
+/* warmup and calibrate loops before the start, nothing here gets reported */
+static void ipi_bench_prepare(struct bench_args *ba, ipi_bench_fn fn)
+{
+	ba->loops = loops;
+
+	/* fn stops on stop_run, which an aborted start sets as well */
+	if (warmup > 0) {
+		fn(ba, warmup, 0);
+		ipi_bench_clear(ba);
+	}
+
+	if (atomic64_read(&start_abort))
+		return;
+
+	if (durationms > 0) {
+		fn(ba, PILOT_LOOPS, 0);
+		ba->loops = ipi_bench_calibrate(ba);
+		ipi_bench_clear(ba);
+	}
+}
+
+static void ipi_bench_run(struct bench_args *ba, ipi_bench_fn fn)
+{
+	unsigned long end = 0;
+
+	if (durationms > 0)
+		end = atomic64_read(&start_tsc) + tsc_khz * (unsigned long)durationms;
+
+	atomic64_set(&ba->start, gettime());
+	fn(ba, ba->loops, end);
+	ba->stopped = !!atomic64_read(&stop_run);
+}
+
+/*
+ * let all threads run at the same time. to avoid wakeup delay, the coordinator
+ * publishes a TSC deadline once all the workers get ready, and every worker
+ * spins to it. yield CPU before the deadline is known, the coordinator may
+ * share the CPU with this worker.
+ */
+static int ipi_bench_wait_start(struct bench_args *ba)
+{
+	unsigned long deadline, now;
+
+	atomic64_add(1, (atomic64_t *)&ready_to_run);
+	while (!(deadline = atomic64_read(&start_tsc))) {
+		if (atomic64_read(&start_abort)) {
+			printk(KERN_INFO "ipi_bench: start aborted, exit benchmark\n");
+			return -1;
+		}
+
+		cond_resched();
+		cpu_relax();
+	}
+
+	while ((now = ins_rdtsc()) < deadline)
+		cpu_relax();
+
+	ba->skew = now - deadline;
+
+	return 0;
+}
+
 static int ipi_bench_single_task(void *data)
 {
 	struct bench_args *ba = (struct bench_args*)data;
 
 	atomic64_set(&ba->forked, gettime());
+	ipi_bench_prepare(ba, ipi_bench_one);
 
-	/* let all threads run at the same time. to avoid wakeup delay */
-	atomic64_add(1, (atomic64_t *)&ready_to_run);
-	while (atomic64_read(&ready_to_run) < atomic64_read(&should_run));
-	if (atomic64_read(&ready_to_run) != atomic64_read(&should_run)) {
-		printk(KERN_INFO "ipi_bench: BUG, exit benchmark\n");
+	if (ipi_bench_wait_start(ba) < 0) {
+		ipi_bench_done();
 		return -1;
 	}
 
-	atomic64_set(&ba->start, gettime());
-	ipi_bench_one(ba);
-	atomic64_set(&ba->finish, gettime());
-	ipi_bench_record_run_delay(ba);
-	atomic64_add(1, (atomic64_t *)&complete_run);
-
-	wake_up_interruptible(&wait_complete);
+	ipi_bench_run(ba, ipi_bench_one);
+	ipi_bench_complete(ba);
 
 	return 0;
 }
@@ -160,6 +440,7 @@ static int ipi_bench_one_task(struct bench_args *ba)
 	}
 
 	kthread_bind(tsk, src);
+	atomic64_add(1, (atomic64_t *)&should_run);
 	wake_up_process(tsk);
 
 	return 0;
@@ -169,27 +450,185 @@ static void ipi_bench_empty(void *info)
 {
 }
 
+/* data touched by the payload callbacks, one per broadcast worker */
+struct payload_ctx {
+	spinlock_t lock;
+	atomic64_t counter ____cacheline_aligned;
+	unsigned long *packed;	/* one counter per CPU, packed */
+	unsigned long *lines;	/* lines cachelines */
+};
+
+/* read only, shared by all the workers */
+static unsigned long *remote_bufs[MAX_NUMNODES];
+static unsigned long remote_size;
+
+static DEFINE_PER_CPU(unsigned long, ipi_bench_counter);
+static DEFINE_PER_CPU(unsigned long, ipi_bench_remote_off);
+
+#define LONGS_PER_LINE	(L1_CACHE_BYTES / sizeof(unsigned long))
+
 static void ipi_bench_spinlock(void *info)
 {
-	spinlock_t *lock = (spinlock_t *)info;
+	struct payload_ctx *ctx = info;
+
+	spin_lock(&ctx->lock);
+	spin_unlock(&ctx->lock);
+}
+
+static void ipi_bench_atomic(void *info)
+{
+	struct payload_ctx *ctx = info;
+
+	atomic64_inc(&ctx->counter);
+}
+
+static void ipi_bench_percpu(void *info)
+{
+	this_cpu_inc(ipi_bench_counter);
+}
+
+static void ipi_bench_falseshare(void *info)
+{
+	struct payload_ctx *ctx = info;
+
+	WRITE_ONCE(ctx->packed[smp_processor_id()], ctx->packed[smp_processor_id()] + 1);
+}
+
+static void ipi_bench_cachelines(void *info)
+{
+	struct payload_ctx *ctx = info;
+	int i;
+
+	for (i = 0; i < lines; i++)
+		WRITE_ONCE(ctx->lines[i * LONGS_PER_LINE], ctx->lines[i * LONGS_PER_LINE] + 1);
+}
+
+/* walk through a buffer larger than LLC, so the reads really go to the remote node */
+static void ipi_bench_remote(void *info)
+{
+	int node = next_online_node(numa_node_id());
+	unsigned long off = __this_cpu_read(ipi_bench_remote_off);
+	unsigned long *buf, sum = 0;
+	int i;
+
+	if (node >= MAX_NUMNODES)
+		node = first_online_node;
+
+	buf = remote_bufs[node];
+	for (i = 0; i < lines; i++) {
+		sum += READ_ONCE(buf[off]);
+		off = (off + LONGS_PER_LINE) % remote_size;
+	}
+
+	__this_cpu_write(ipi_bench_remote_off, off);
+	__this_cpu_add(ipi_bench_counter, sum);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,13,0)
+#define __native_read_cr3 native_read_cr3
+#endif
+
+/* flush_tlb_local() is not exported, reloading CR3 does the same */
+static void ipi_bench_tlbflush(void *info)
+{
+	native_write_cr3(__native_read_cr3());
+}
+
+static smp_call_func_t payload_funcs[] = {
+	[PAYLOAD_EMPTY]		= ipi_bench_empty,
+	[PAYLOAD_SPINLOCK]	= ipi_bench_spinlock,
+	[PAYLOAD_ATOMIC]	= ipi_bench_atomic,
+	[PAYLOAD_PERCPU]	= ipi_bench_percpu,
+	[PAYLOAD_FALSESHARE]	= ipi_bench_falseshare,
+	[PAYLOAD_CACHELINES]	= ipi_bench_cachelines,
+	[PAYLOAD_REMOTE]	= ipi_bench_remote,
+	[PAYLOAD_TLBFLUSH]	= ipi_bench_tlbflush,
+};
+
+static struct payload_ctx *ipi_bench_payload_alloc(int node)
+{
+	struct payload_ctx *ctx;
+
+	ctx = kzalloc_node(sizeof(*ctx), GFP_KERNEL, node);
+	if (!ctx)
+		return NULL;
+
+	spin_lock_init(&ctx->lock);
+	ctx->packed = kzalloc_node(sizeof(unsigned long) * nr_cpu_ids, GFP_KERNEL, node);
+	ctx->lines = kzalloc_node(L1_CACHE_BYTES * lines, GFP_KERNEL, node);
+	if (!ctx->packed || !ctx->lines) {
+		kfree(ctx->packed);
+		kfree(ctx->lines);
+		kfree(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static void ipi_bench_payload_free(struct payload_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	kfree(ctx->packed);
+	kfree(ctx->lines);
+	kfree(ctx);
+}
+
+static void ipi_bench_remote_free(void)
+{
+	int node;
 
-	spin_lock(lock);
-	spin_unlock(lock);
+	for (node = 0; node < MAX_NUMNODES; node++) {
+		vfree(remote_bufs[node]);
+		remote_bufs[node] = NULL;
+	}
 }
 
-static int ipi_bench_many(void)
+static int ipi_bench_remote_alloc(void)
 {
-	int loop;
-	DEFINE_SPINLOCK(spinlock);
+	int node, cpu;
+
+	if (num_online_nodes() < 2)
+		printk(KERN_INFO "ipi_bench: single NUMA node, remote payload reads local memory\n");
 
-	for (loop = loops; loop > 0; loop--) {
-		if (lock) {
-			smp_call_function_many(cpu_online_mask, ipi_bench_spinlock, &spinlock, wait);
-		} else {
-			smp_call_function_many(cpu_online_mask, ipi_bench_empty, NULL, wait);
+	remote_size = (unsigned long)remotemb * 1024 * 1024 / sizeof(unsigned long);
+	for_each_online_node(node) {
+		remote_bufs[node] = vzalloc_node(remote_size * sizeof(unsigned long), node);
+		if (!remote_bufs[node]) {
+			ipi_bench_remote_free();
+			return -1;
 		}
 	}
 
+	/* CPUs on the same node start from different lines, not to share LLC */
+	for_each_possible_cpu(cpu) {
+		per_cpu(ipi_bench_remote_off, cpu) = (remote_size / nr_cpu_ids * cpu) & ~(LONGS_PER_LINE - 1);
+	}
+
+	return 0;
+}
+
+static int ipi_bench_many(struct bench_args *ba, unsigned long n, unsigned long end)
+{
+	smp_call_func_t func = payload_funcs[payload];
+	unsigned long csw, tsc;
+
+	while (n--) {
+		csw = ipi_bench_csw();
+		tsc = ins_rdtsc();
+		if (ipi_bench_should_stop(tsc, end))
+			break;
+
+		smp_call_function_many(ba->mask, func, ba->ctx, wait);
+		ipi_bench_account(ba, ins_rdtsc() - tsc, csw != ipi_bench_csw());
+	}
+
+	/* flush the pending callbacks before ctx gets freed */
+	if (!wait)
+		smp_call_function_many(ba->mask, ipi_bench_empty, NULL, 1);
+
 	return 0;
 }
 
@@ -199,21 +638,24 @@ static int ipi_bench_many_task(void *data)
 
 	atomic64_set(&ba->forked, gettime());
 
-	/* let all threads run at the same time. to avoid wakeup delay */
-	atomic64_add(1, (atomic64_t *)&ready_to_run);
-	while (atomic64_read(&ready_to_run) < atomic64_read(&should_run));
-	if (atomic64_read(&ready_to_run) != atomic64_read(&should_run)) {
-		printk(KERN_INFO "ipi_bench: BUG, exit benchmark\n");
+	ba->ctx = ipi_bench_payload_alloc(cpu_to_node(ba->src));
+	if (!ba->ctx) {
+		printk(KERN_INFO "ipi_bench: no enough memory\n");
+		ipi_bench_done();
 		return -1;
 	}
 
-	atomic64_set(&ba->start, gettime());
-	ipi_bench_many();
-	atomic64_set(&ba->finish, gettime());
-	ipi_bench_record_run_delay(ba);
-	atomic64_add(1, (atomic64_t *)&complete_run);
+	ipi_bench_prepare(ba, ipi_bench_many);
 
-	wake_up_interruptible(&wait_complete);
+	if (ipi_bench_wait_start(ba) < 0) {
+		ipi_bench_payload_free(ba->ctx);
+		ipi_bench_done();
+		return -1;
+	}
+
+	ipi_bench_run(ba, ipi_bench_many);
+	ipi_bench_payload_free(ba->ctx);
+	ipi_bench_complete(ba);
 
 	return 0;
 }
@@ -233,18 +675,143 @@ static int ipi_bench_all_task(struct bench_args *ba)
 	}
 
 	kthread_bind(tsk, src);
+	atomic64_add(1, (atomic64_t *)&should_run);
+	wake_up_process(tsk);
+
+	return 0;
+}
+
+static int ipi_bench_multicast_task(struct bench_args *ba)
+{
+	struct task_struct *tsk;
+	int src = ba->src;
+
+	snprintf(ba->name, sizeof(ba->name), "ipi_bench_mc_%d", src);
+
+	tsk = kthread_create_on_node(ipi_bench_many_task, ba, cpu_to_node(src), ba->name);
+	if (IS_ERR(tsk)) {
+		printk(KERN_INFO "ipi_bench: create kthread failed\n");
+		return -1;
+	}
+
+	kthread_bind(tsk, src);
+	atomic64_add(1, (atomic64_t *)&should_run);
 	wake_up_process(tsk);
 
 	return 0;
 }
 
+/* should_run counts the workers actually created */
+static void ipi_bench_reset(void)
+{
+	atomic64_set(&should_run, 0);
+	atomic64_set(&ready_to_run, 0);
+	atomic64_set(&complete_run, 0);
+	atomic64_set(&start_tsc, 0);
+	atomic64_set(&start_abort, 0);
+	atomic64_set(&stop_run, 0);
+}
+
+/* wait all the workers ready, then publish a common TSC deadline to start */
+static int ipi_bench_start_all(void)
+{
+	unsigned long timeout = jiffies + msecs_to_jiffies(timeoutms);
+
+	while (atomic64_read(&ready_to_run) < atomic64_read(&should_run)) {
+		if (time_after(jiffies, timeout)) {
+			printk(KERN_INFO "ipi_bench: workers not ready, abort benchmark\n");
+			atomic64_set(&start_abort, 1);
+			atomic64_set(&stop_run, 1);
+			/*
+			 * the ready workers exit at once, the late ones as soon as
+			 * they run. the module text goes away after init, no timeout.
+			 */
+			wait_event(wait_complete,
+					atomic64_read(&complete_run) == atomic64_read(&should_run));
+			return -1;
+		}
+
+		msleep(1);
+	}
+
+	atomic64_set(&start_tsc, ins_rdtsc() + tsc_khz * START_DELAY_US / 1000);
+
+	return 0;
+}
+
 static inline void ipi_bench_wait_all(void)
 {
-	wait_event_interruptible_timeout(wait_complete,
+	if (wait_event_interruptible_timeout(wait_complete,
 			atomic64_read(&complete_run) == atomic64_read(&should_run),
-			msecs_to_jiffies(timeoutms));
+			msecs_to_jiffies(timeoutms)) > 0)
+		return;
+
+	/*
+	 * the workers check stop_run every iteration, they finish soon. they run
+	 * the module text and use their data, which both go away after init, so
+	 * wait for them without timeout.
+	 */
+	printk(KERN_INFO "ipi_bench: timeout %ld ms, stop workers and report partial statistics\n", timeoutms);
+	atomic64_set(&stop_run, 1);
+	wait_event(wait_complete,
+			atomic64_read(&complete_run) == atomic64_read(&should_run));
+}
+
+/* elapsed ns from the first worker start to the last worker finish */
+static unsigned long ipi_bench_window(struct bench_args *bas, int workers)
+{
+	unsigned long start = ULONG_MAX, finish = 0;
+	int i;
+
+	for (i = 0; i < workers; i++) {
+		start = min_t(unsigned long, start, atomic64_read(&bas[i].start));
+		finish = max_t(unsigned long, finish, atomic64_read(&bas[i].finish));
+	}
+
+	return finish > start ? finish - start : 1;
+}
+
+static unsigned long ipi_bench_iterations(struct bench_args *bas, int workers)
+{
+	unsigned long iterations = 0;
+	int i;
+
+	for (i = 0; i < workers; i++)
+		iterations += bas[i].hist.total;
+
+	return iterations;
+}
+
+static void ipi_bench_report_skew(struct bench_args *bas, int workers)
+{
+	unsigned long skew = 0;
+	int i;
+
+	for (i = 0; i < workers; i++)
+		skew = max(skew, bas[i].skew);
+
+	printk(KERN_INFO "ipi_bench: %d workers, max start skew [%ld] cycles [%ld] ns\n",
+			workers, skew, cycles_to_ns(skew));
 }
 
+static inline void ipi_bench_report_iterations(struct bench_args *ba)
+{
+	struct hist *h = &ba->hist;
+
+	unsigned long ci95 = ipi_bench_ci(ba);
+
+	printk(KERN_INFO "ipi_bench:     skew [%ld] cycles, disturbed [%ld/%ld], "
+			"p50 [%ld] p99 [%ld] max [%ld] in ns, CI95 [%ld.%ld%%]%s\n",
+			ba->skew, ba->disturbed, h->total,
+			cycles_to_ns(hist_percentile(h, 50)), cycles_to_ns(hist_percentile(h, 99)),
+			cycles_to_ns(h->max), ci95 / 10, ci95 % 10,
+			ba->stopped ? ", stopped by timeout, partial" : "");
+}
+
+/*
+ * AVG call and ipi only count the iterations not disturbed, sched run delay is
+ * reported for reference and never subtracted from elapsed.
+ */
 static inline void ipi_bench_report_single(struct bench_args *ba)
 {
 	int src = ba->src;
@@ -255,22 +822,20 @@ static inline void ipi_bench_report_single(struct bench_args *ba)
 	unsigned long ipitime = atomic64_read(&ba->ipitime);
 	unsigned long run_delay = atomic64_read(&ba->run_delay);
 	unsigned long elapsed = finish - start;
+	unsigned long clean = ba->clean ? ba->clean : 1;
 
 	if (!finish) {
-		printk(KERN_INFO "ipi_bench: too many loops\n");
+		printk(KERN_INFO "ipi_bench: CPU [%3d] worker not finished\n", src);
 		return;
 	}
 
-	if (elapsed > run_delay) {
-		elapsed -= run_delay;
-	}
-
-	printk(KERN_INFO "ipi_bench: CPU [%3d] [NODE%d] -> CPU [%3d] [NODE%d], wait [%d], loops [%d] "
+	printk(KERN_INFO "ipi_bench: CPU [%3d] [NODE%d] -> CPU [%3d] [NODE%d], wait [%d], loops [%ld] "
 			"forked [%ld], start [%ld], finish [%ld], elapsed [%ld], ipitime [%ld], run delay [%ld] in ms, "
 			"AVG call [%ld], ipi [%ld] in ns\n",
-			src, cpu_to_node(src), dst, cpu_to_node(dst), wait, loops,
+			src, cpu_to_node(src), dst, cpu_to_node(dst), wait, ba->hist.total,
 			forked / 1000, start / 1000, finish / 1000, elapsed / 1000, ipitime / 1000, run_delay / 1000,
-			elapsed / loops, ipitime / loops);
+			cycles_to_ns(ba->clean_cycles / clean), ipitime / clean);
+	ipi_bench_report_iterations(ba);
 }
 
 static inline void ipi_bench_report_all(struct bench_args *ba)
@@ -281,22 +846,20 @@ static inline void ipi_bench_report_all(struct bench_args *ba)
 	unsigned long finish = atomic64_read(&ba->finish);
 	unsigned long run_delay = atomic64_read(&ba->run_delay);
 	unsigned long elapsed = finish - start;
+	unsigned long clean = ba->clean ? ba->clean : 1;
 
 	if (!finish) {
-		printk(KERN_INFO "ipi_bench: too many loops\n");
+		printk(KERN_INFO "ipi_bench: CPU [%3d] worker not finished\n", src);
 		return;
 	}
 
-	if (elapsed > run_delay) {
-		elapsed -= run_delay;
-	}
-
-	printk(KERN_INFO "ipi_bench: CPU [%3d] [NODE%d] -> all CPUs, wait [%d], loops [%d] "
+	printk(KERN_INFO "ipi_bench: CPU [%3d] [NODE%d] -> all CPUs, payload [%d], wait [%d], loops [%ld] "
 			"forked [%ld], start [%ld], finish [%ld], elapsed [%ld], run delay [%ld] in ms "
 			"AVG call [%ld] in ns\n",
-			src, cpu_to_node(src), wait, loops,
+			src, cpu_to_node(src), payload, wait, ba->hist.total,
 			forked / 1000, start / 1000, finish / 1000, elapsed / 1000, run_delay / 1000,
-			elapsed / loops);
+			cycles_to_ns(ba->clean_cycles / clean));
+	ipi_bench_report_iterations(ba);
 }
 
 static int ipi_bench_self(int src)
@@ -312,10 +875,12 @@ static int ipi_bench_self(int src)
 	ba->src = src;
 	ba->dst = src;
 
-	atomic64_set(&should_run, 1);
+	ipi_bench_reset();
 	ipi_bench_one_task(ba);
-	ipi_bench_wait_all();
-	ipi_bench_report_single(ba);
+	if (ipi_bench_start_all() == 0) {
+		ipi_bench_wait_all();
+		ipi_bench_report_single(ba);
+	}
 
 	kfree(ba);
 
@@ -335,10 +900,12 @@ static int ipi_bench_single(int src, int dst)
 	ba->src = src;
 	ba->dst = dst;
 
-	atomic64_set(&should_run, 1);
+	ipi_bench_reset();
 	ipi_bench_one_task(ba);
-	ipi_bench_wait_all();
-	ipi_bench_report_single(ba);
+	if (ipi_bench_start_all() == 0) {
+		ipi_bench_wait_all();
+		ipi_bench_report_single(ba);
+	}
 
 	kfree(ba);
 
@@ -374,7 +941,7 @@ static int ipi_bench_mesh(int pairs, int acrossnuma)
 	cpumask_var_t cpumask;
 	struct bench_args *bas = NULL;
 	struct bench_args *ba;
-	unsigned long startns, elapsed;
+	unsigned long elapsed;
 	int ret = -1, i, node = -1;
 
 	zalloc_cpumask_var(&cpumask, GFP_KERNEL);
@@ -384,7 +951,7 @@ static int ipi_bench_mesh(int pairs, int acrossnuma)
 		goto out;
 	}
 
-	atomic64_set(&should_run, pairs);
+	ipi_bench_reset();
 
 	/* build pairs one by one */
 	for (i = 0; i < pairs; i++) {
@@ -406,16 +973,20 @@ static int ipi_bench_mesh(int pairs, int acrossnuma)
 		ipi_bench_one_task(ba);
 	}
 
-	startns = getns();
+	if (ipi_bench_start_all() < 0)
+		goto out;
+
 	ipi_bench_wait_all();
-	elapsed = getns() - startns;
+	elapsed = ipi_bench_window(bas, pairs);
 
 	for (i = 0; i < pairs; i++) {
 		ba = bas + i;
 		ipi_bench_report_single(ba);
 	}
 
-	printk(KERN_INFO "ipi_bench: throughput %ld ipi/s\n", pairs * loops * 1000000000UL / elapsed);
+	ipi_bench_report_skew(bas, pairs);
+
+	printk(KERN_INFO "ipi_bench: throughput %ld ipi/s\n", ipi_bench_iterations(bas, pairs) * 1000000000UL / elapsed);
 
 	ret = 0;
 
@@ -431,7 +1002,7 @@ static int ipi_bench_all(int broadcasts)
 	cpumask_var_t cpumask;
 	struct bench_args *bas = NULL;
 	struct bench_args *ba;
-	unsigned long startns, elapsed;
+	unsigned long elapsed;
 	int ret = -1, i;
 
 	zalloc_cpumask_var(&cpumask, GFP_KERNEL);
@@ -441,11 +1012,12 @@ static int ipi_bench_all(int broadcasts)
 		goto out;
 	}
 
-	atomic64_set(&should_run, broadcasts);
+	ipi_bench_reset();
 
 	/* build broadcasts one by one */
 	for (i = 0; i < broadcasts; i++) {
 		ba = bas + i;
+		ba->mask = cpu_online_mask;
 		ba->src = __random_unused_cpu_in_cpumask(cpumask, -1);
 		if (ba->src < 0) {
 			printk(KERN_INFO "ipi_bench: init broadcast workers failed\n");
@@ -458,17 +1030,20 @@ static int ipi_bench_all(int broadcasts)
 		ipi_bench_all_task(ba);
 	}
 
-	startns = getns();
+	if (ipi_bench_start_all() < 0)
+		goto out;
+
 	ipi_bench_wait_all();
-	elapsed = getns() - startns;
+	elapsed = ipi_bench_window(bas, broadcasts);
 
 	for (i = 0; i < broadcasts; i++) {
 		ba = bas + i;
 		ipi_bench_report_all(ba);
 	}
 
+	ipi_bench_report_skew(bas, broadcasts);
 
-	printk(KERN_INFO "ipi_bench: throughput %ld ipi/s\n", broadcasts * (num_online_cpus() - 1) * loops * 1000000000UL / elapsed);
+	printk(KERN_INFO "ipi_bench: throughput %ld ipi/s\n", (num_online_cpus() - 1) * ipi_bench_iterations(bas, broadcasts) * 1000000000UL / elapsed);
 
 	ret = 0;
 
@@ -479,6 +1054,385 @@ out:
 	return ret;
 }
 
+/* count of destinations, smp_call_function_many() skips the sender itself */
+static int ipi_bench_mask_dests(const struct cpumask *mask, int src)
+{
+	return cpumask_weight(mask) - !!cpumask_test_cpu(src, mask);
+}
+
+static int ipi_bench_mask_nodes(const struct cpumask *mask)
+{
+	nodemask_t nodes = NODE_MASK_NONE;
+	int cpu;
+
+	for_each_cpu(cpu, mask)
+		node_set(cpu_to_node(cpu), nodes);
+
+	return nodes_weight(nodes);
+}
+
+/*
+ * pick count destinations except src.
+ * compact: fill the node of src first, then the other nodes by node_distance()
+ *          from the node of src, the nearest first.
+ * scatter: take one CPU from each node in turn.
+ */
+static int ipi_bench_build_mask(struct cpumask *mask, int src, int count, int spread)
+{
+	int node, cpu, picked = 0, progress, from, nearest;
+	nodemask_t filled = NODE_MASK_NONE;
+
+	cpumask_clear(mask);
+
+	if (spread == SPREAD_COMPACT) {
+		from = cpu_to_node(src);
+		for (;;) {
+			/* the node of src itself has the smallest distance */
+			nearest = NUMA_NO_NODE;
+			for_each_online_node(node) {
+				if (node_isset(node, filled))
+					continue;
+
+				if ((nearest == NUMA_NO_NODE) || (node_distance(from, node) < node_distance(from, nearest)))
+					nearest = node;
+			}
+
+			if (nearest == NUMA_NO_NODE)
+				return picked;
+
+			node_set(nearest, filled);
+			for_each_cpu(cpu, cpumask_of_node(nearest)) {
+				if (picked == count)
+					return picked;
+
+				if ((cpu != src) && cpu_online(cpu)) {
+					cpumask_set_cpu(cpu, mask);
+					picked++;
+				}
+			}
+		}
+	}
+
+	do {
+		progress = 0;
+		for_each_online_node(node) {
+			for_each_cpu(cpu, cpumask_of_node(node)) {
+				if ((cpu == src) || !cpu_online(cpu) || cpumask_test_cpu(cpu, mask))
+					continue;
+
+				if (picked == count)
+					return picked;
+
+				cpumask_set_cpu(cpu, mask);
+				picked++;
+				progress = 1;
+				break;
+			}
+		}
+	} while (progress);
+
+	return picked;
+}
+
+static inline void ipi_bench_report_multicast(struct bench_args *ba, const char *tag)
+{
+	int src = ba->src;
+	int ndests = ipi_bench_mask_dests(ba->mask, src);
+	unsigned long finish = atomic64_read(&ba->finish);
+	unsigned long clean = ba->clean ? ba->clean : 1;
+	unsigned long call = cycles_to_ns(ba->clean_cycles / clean);
+
+	if (!finish) {
+		printk(KERN_INFO "ipi_bench: CPU [%3d] worker not finished\n", src);
+		return;
+	}
+
+	printk(KERN_INFO "ipi_bench: CPU [%3d] [NODE%d] -> %3d CPUs [%s] across %d node(s), payload [%d], wait [%d], loops [%ld] "
+			"AVG call [%ld], per destination [%ld] in ns\n",
+			src, cpu_to_node(src), ndests, tag, ipi_bench_mask_nodes(ba->mask), payload, wait, ba->hist.total,
+			call, ndests ? call / ndests : 0);
+	ipi_bench_report_iterations(ba);
+}
+
+static int ipi_bench_multicast_one(struct bench_args *ba, const char *tag)
+{
+	int src = ba->src;
+	const struct cpumask *mask = ba->mask;
+
+	if (!ipi_bench_mask_dests(mask, src)) {
+		printk(KERN_INFO "ipi_bench: no destination for multicast\n");
+		return -1;
+	}
+
+	memset(ba, 0, sizeof(*ba));
+	ba->src = src;
+	ba->mask = mask;
+
+	ipi_bench_reset();
+	if (ipi_bench_multicast_task(ba) < 0)
+		return -1;
+
+	if (ipi_bench_start_all() < 0)
+		return -1;
+
+	ipi_bench_wait_all();
+	ipi_bench_report_multicast(ba, tag);
+
+	return 0;
+}
+
+static int ipi_bench_multicast(int src)
+{
+	static const char *spreads[] = { "compact", "scatter" };
+	cpumask_var_t cpumask;
+	struct bench_args *ba;
+	int ret = -1, count, sp, max = num_online_cpus() - 1;
+
+	if (!zalloc_cpumask_var(&cpumask, GFP_KERNEL)) {
+		printk(KERN_INFO "ipi_bench: no enough memory\n");
+		return -1;
+	}
+
+	ba = kzalloc(sizeof(*ba), GFP_KERNEL);
+	if (!ba) {
+		printk(KERN_INFO "ipi_bench: no enough memory\n");
+		goto out;
+	}
+
+	ba->src = src;
+	ba->mask = cpumask;
+
+	if (dstlist) {
+		if (cpulist_parse(dstlist, cpumask) < 0) {
+			printk(KERN_INFO "ipi_bench: invalid dstlist %s\n", dstlist);
+			goto out;
+		}
+
+		cpumask_and(cpumask, cpumask, cpu_online_mask);
+		ret = ipi_bench_multicast_one(ba, "dstlist");
+		goto out;
+	}
+
+	printk(KERN_INFO "ipi_bench: prepare multicast IPI from CPU[%3d]\n", src);
+	for (sp = SPREAD_COMPACT; sp <= SPREAD_SCATTER; sp++) {
+		if ((spread >= 0) && (spread != sp))
+			continue;
+
+		/* the last round of the sweep covers all the CPUs */
+		for (count = (dests > 0) ? dests : 1; ; count = min(count * 2, max)) {
+			ipi_bench_build_mask(cpumask, src, count, sp);
+			if (ipi_bench_multicast_one(ba, spreads[sp]) < 0)
+				goto out;
+
+			if ((dests > 0) || (count >= max))
+				break;
+		}
+	}
+
+	ret = 0;
+
+out:
+	kfree(ba);
+	free_cpumask_var(cpumask);
+
+	return ret;
+}
+
+/* per-CPU latency from sending to callback, in cycles. only the owner CPU writes */
+static struct hist *rx_hists;
+
+/* the TSC of sending is passed by info itself, nothing shared with the sender */
+static void ipi_bench_receiver(void *info)
+{
+	unsigned long now = ins_rdtsc();
+	unsigned long sent = (unsigned long)info;
+
+	if (now > sent)
+		hist_add(&rx_hists[smp_processor_id()], now - sent);
+}
+
+static int ipi_bench_spawn(struct bench_args *ba, int (*fn)(void *data), int cpu)
+{
+	struct task_struct *tsk;
+
+	tsk = kthread_create_on_node(fn, ba, cpu_to_node(cpu), ba->name);
+	if (IS_ERR(tsk)) {
+		printk(KERN_INFO "ipi_bench: create kthread failed\n");
+		return -1;
+	}
+
+	kthread_bind(tsk, cpu);
+	atomic64_add(1, (atomic64_t *)&should_run);
+	wake_up_process(tsk);
+
+	return 0;
+}
+
+/* send ipi at ba->rate until the victim finishes, don't burst to catch up */
+static int ipi_bench_rate_task(void *data)
+{
+	struct bench_args *ba = (struct bench_args*)data;
+	unsigned long deadline, end, period, next, now, csw;
+
+	atomic64_set(&ba->forked, gettime());
+
+	if (ipi_bench_wait_start(ba) < 0) {
+		ipi_bench_done();
+		return -1;
+	}
+
+	atomic64_set(&ba->start, gettime());
+	deadline = atomic64_read(&start_tsc);
+	end = deadline + tsc_khz * (unsigned long)victimms;
+	period = ba->rate ? tsc_khz * 1000UL / ba->rate : 0;
+	next = deadline;
+
+	while (ba->rate) {
+		now = ins_rdtsc();
+		if (ipi_bench_should_stop(now, end))
+			break;
+
+		if (now < next) {
+			cpu_relax();
+			continue;
+		}
+
+		csw = ipi_bench_csw();
+		if (smp_call_function_single(ba->dst, ipi_bench_receiver, (void *)ins_rdtsc(), wait) < 0)
+			break;
+
+		ipi_bench_account(ba, ins_rdtsc() - now, csw != ipi_bench_csw());
+		ba->sent++;
+		next = max(next + period, now);
+	}
+
+	/* flush the pending callbacks before rx_hists gets freed */
+	if (!wait)
+		smp_call_function_single(ba->dst, ipi_bench_empty, NULL, 1);
+
+	ipi_bench_complete(ba);
+
+	return 0;
+}
+
+/* spin on TSC, any gap longer than victimgap is stolen from this CPU */
+static int ipi_bench_victim_task(void *data)
+{
+	struct bench_args *ba = (struct bench_args*)data;
+	unsigned long end, now, last, gap;
+
+	atomic64_set(&ba->forked, gettime());
+
+	if (ipi_bench_wait_start(ba) < 0) {
+		ipi_bench_done();
+		return -1;
+	}
+
+	atomic64_set(&ba->start, gettime());
+	end = atomic64_read(&start_tsc) + tsc_khz * (unsigned long)victimms;
+	last = ins_rdtsc();
+
+	for (;;) {
+		now = ins_rdtsc();
+		if (ipi_bench_should_stop(now, end))
+			break;
+
+		gap = now - last;
+		if (gap > victimgap) {
+			ba->stolen += gap;
+			hist_add(&ba->hist, gap);
+		}
+
+		last = now;
+	}
+
+	ipi_bench_complete(ba);
+
+	return 0;
+}
+
+static inline void ipi_bench_report_receiver(struct bench_args *sender, struct bench_args *victim,
+		unsigned long baseline)
+{
+	struct hist *rx = &rx_hists[sender->dst];
+	struct hist *gaps = &victim->hist;
+	unsigned long stolen = cycles_to_ns(victim->stolen) * 1000 / victimms;	/* ns/s */
+	unsigned long extra = stolen > baseline ? stolen - baseline : 0;
+	unsigned long sent = sender->sent * 1000 / victimms;	/* ipi/s */
+
+	if (!atomic64_read(&sender->finish) || !atomic64_read(&victim->finish)) {
+		printk(KERN_INFO "ipi_bench: receiver-ipi not finished\n");
+		return;
+	}
+
+	printk(KERN_INFO "ipi_bench: CPU [%3d] [NODE%d] -> CPU [%3d] [NODE%d], wait [%d], rate [%d] achieved [%ld] ipi/s, "
+			"receiver latency p50 [%ld] p99 [%ld] max [%ld] in ns\n",
+			sender->src, cpu_to_node(sender->src), sender->dst, cpu_to_node(sender->dst), wait,
+			sender->rate, sent, cycles_to_ns(hist_percentile(rx, 50)),
+			cycles_to_ns(hist_percentile(rx, 99)), cycles_to_ns(rx->max));
+	printk(KERN_INFO "ipi_bench:     victim stolen [%ld] ns/s [%ld.%02ld%%], gaps [%ld] "
+			"p50 [%ld] p99 [%ld] max [%ld] in ns, stolen per ipi [%ld] ns\n",
+			stolen, stolen / 10000000, stolen / 100000 % 100, gaps->total,
+			cycles_to_ns(hist_percentile(gaps, 50)), cycles_to_ns(hist_percentile(gaps, 99)),
+			cycles_to_ns(gaps->max), sent ? extra / sent : 0);
+}
+
+/*
+ * the run of rate 0 sends no ipi, the time stolen by timers and other
+ * interrupts is the baseline of the following runs.
+ */
+static int ipi_bench_receiver_cost(int src, int dst)
+{
+	struct bench_args *bas, *sender, *victim;
+	unsigned long baseline = 0;
+	int i, ret = -1;
+
+	bas = kcalloc(2, sizeof(*bas), GFP_KERNEL);
+	rx_hists = kcalloc(nr_cpu_ids, sizeof(*rx_hists), GFP_KERNEL);
+	if (!bas || !rx_hists) {
+		printk(KERN_INFO "ipi_bench: no enough memory\n");
+		goto out;
+	}
+
+	printk(KERN_INFO "ipi_bench: prepare receiver-ipi from CPU[%3d] to CPU[%3d]\n", src, dst);
+	for (i = 0; i < nr_rates; i++) {
+		memset(bas, 0, sizeof(*bas) * 2);
+		memset(&rx_hists[dst], 0, sizeof(*rx_hists));
+
+		sender = bas;
+		sender->src = src;
+		sender->dst = dst;
+		sender->rate = rates[i];
+		snprintf(sender->name, sizeof(sender->name), "ipi_bench_rate_%d", src);
+
+		victim = bas + 1;
+		victim->src = dst;
+		victim->dst = dst;
+		snprintf(victim->name, sizeof(victim->name), "ipi_bench_victim_%d", dst);
+
+		ipi_bench_reset();
+		ipi_bench_spawn(sender, ipi_bench_rate_task, src);
+		ipi_bench_spawn(victim, ipi_bench_victim_task, dst);
+		if (ipi_bench_start_all() < 0)
+			goto out;
+
+		ipi_bench_wait_all();
+		if (!rates[i])
+			baseline = cycles_to_ns(victim->stolen) * 1000 / victimms;
+
+		ipi_bench_report_receiver(sender, victim, baseline);
+	}
+
+	ret = 0;
+
+out:
+	kfree(rx_hists);
+	rx_hists = NULL;
+	kfree(bas);
+
+	return ret;
+}
+
 static void ipi_bench_options(void)
 {
 	int i;
@@ -487,12 +1441,18 @@ static void ipi_bench_options(void)
 	for (i = 0; i < sizeof(benchcases) / sizeof(benchcases[0]); i++) {
 		printk(KERN_INFO "ipi_bench:\tbit[%d] %s\n", i, benchcases[i]);
 	}
+
+	printk(KERN_INFO "ipi_bench: payload=XX of all-ipi and multicast-ipi callback:\n");
+	for (i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+		printk(KERN_INFO "ipi_bench:\t%d %s\n", i, payloads[i]);
+	}
 }
 
 /* assign different src & dst cpu if unspecified */
 static int ipi_bench_init_params(void)
 {
 	int num_cpus = num_online_cpus();
+	int i;
 
 	if (num_cpus < 2) {
 		printk(KERN_INFO "ipi_bench: total cpu num %d, no need to test\n", num_cpus);
@@ -504,6 +1464,43 @@ static int ipi_bench_init_params(void)
 		return -1;
 	}
 
+	if ((durationms < 0) || (durationms >= timeoutms) || (ci <= 0) || (warmup < 0)) {
+		printk(KERN_INFO "ipi_bench: invalid durationms %d(should be less than %ld), ci %d or warmup %d\n",
+				durationms, timeoutms, ci, warmup);
+		return -1;
+	}
+
+	if ((victimms <= 0) || (victimms >= timeoutms)) {
+		printk(KERN_INFO "ipi_bench: victimms out of range, should be less than %ld\n", timeoutms);
+		return -1;
+	}
+
+	for (i = 0; i < nr_rates; i++) {
+		if (rates[i] < 0) {
+			printk(KERN_INFO "ipi_bench: invalid rate %d\n", rates[i]);
+			return -1;
+		}
+	}
+
+	if (payload == -1) {
+		payload = lock ? PAYLOAD_SPINLOCK : PAYLOAD_EMPTY;
+	}
+
+	if ((payload < 0) || (payload >= sizeof(payloads) / sizeof(payloads[0]))) {
+		printk(KERN_INFO "ipi_bench: invalid payload %d\n", payload);
+		return -1;
+	}
+
+	if ((lines <= 0) || (remotemb <= 0)) {
+		printk(KERN_INFO "ipi_bench: invalid lines %d or remotemb %d\n", lines, remotemb);
+		return -1;
+	}
+
+	if (dests >= num_cpus) {
+		printk(KERN_INFO "ipi_bench: dests out of range, total cpu num %d\n", num_cpus);
+		return -1;
+	}
+
 	if (pairs > (num_cpus / 2)) {
 		printk(KERN_INFO "ipi_bench: pairs out of range, total cpu num %d\n", num_cpus);
 		return -1;
@@ -539,6 +1536,11 @@ static int ipi_bench_init(void)
 		return -1;
 	}
 
+	if ((payload == PAYLOAD_REMOTE) && (ipi_bench_remote_alloc() < 0)) {
+		printk(KERN_INFO "ipi_bench: no enough memory for remote payload\n");
+		return -1;
+	}
+
 	if (options & SELF_IPI) {
 		ipi_bench_self(srccpu);
 	}
@@ -555,6 +1557,16 @@ static int ipi_bench_init(void)
 		ipi_bench_all(broadcasts);
 	}
 
+	if (options & MULTICAST_IPI) {
+		ipi_bench_multicast(srccpu);
+	}
+
+	if (options & RECEIVER_IPI) {
+		ipi_bench_receiver_cost(srccpu, dstcpu);
+	}
+
+	ipi_bench_remote_free();
+
 	return -1;
 }
 
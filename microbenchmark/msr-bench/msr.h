@@ -15,4 +15,14 @@ static inline void ins_wrmsrl(unsigned int msr, unsigned long val)
     ins_wrmsr(msr, (unsigned int)(val & 0xffffffffULL), (unsigned int)(val >> 32));
 }
 
+static inline unsigned long ins_rdmsrl(unsigned int msr)
+{
+    unsigned int low, high;
+
+    asm volatile("rdmsr\n"
+            : "=a" (low), "=d" (high) : "c" (msr));
+
+    return low | ((unsigned long)high << 32);
+}
+
 #endif
@@ -3,89 +3,277 @@
  */
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/slab.h>
+#include <asm/irq_vectors.h>
 #include "msr.h"
 #include "../common/rdtsc.h"
+#include "../common/hist.h"
+#include "../common/parallel.h"
 
 /* see intel SDM, or linux source code */
-#define __MSR_IA32_TSCDEADLINE		0x000006e0
+#define __MSR_IA32_SPEC_CTRL		0x00000048
+#define __MSR_IA32_PMC0			0x000000c1
 #define __MSR_IA32_POWER_CTL		0x000001fc
+#define __MSR_CORE_PERF_FIXED_CTR0	0x00000309
+#define __MSR_CORE_PERF_GLOBAL_CTRL	0x0000038f
+#define __MSR_IA32_TSCDEADLINE		0x000006e0
+#define __MSR_X2APIC_TPR		0x00000808
+#define __MSR_X2APIC_EOI		0x0000080b
+#define __MSR_X2APIC_ICR		0x00000830
+#define __MSR_FS_BASE			0xc0000100
+#define __MSR_KVM_UNUSED		0x4b564dff	/* KVM custom range, never implemented */
+
+#define __APIC_DEST_SELF		0x40000
+
+/* user specified MSRs, benchmark them instead of the table */
+static unsigned int msrs[32];
+static int nr_msrs;
+module_param_array(msrs, uint, &nr_msrs, 0444);
+
+/* also write the user specified MSRs with the value read */
+static int wr;
+module_param(wr, int, 0444);
+
+/* run each MSR on the first cpus=XX CPUs at the same time, 0 means the loading CPU only */
+static int cpus;
+module_param(cpus, int, 0444);
+
+#define LOOP 10000
 
-#define LOOP 100000
+#define MSR_READ	(1<<0)
+#define MSR_WRITE	(1<<1)
 
-static inline void msr_bench_report(char *tag, unsigned long elapsed)
+/* how to get the value to write */
+#define WRITE_SAME	0	/* the value read, keep it unchanged */
+#define WRITE_ZERO	1
+#define WRITE_DEADLINE	2	/* far future, restore the value read after bench */
+#define WRITE_SELF_IPI	3	/* send an IPI to self, handled as an empty call */
+
+struct msr_case {
+	char *category;
+	char *name;
+	unsigned int msr;
+	int ops;
+	int write;
+};
+
+static struct msr_case cases[] = {
+	{ "passthrough", "MSR_FS_BASE", __MSR_FS_BASE, MSR_READ | MSR_WRITE, WRITE_SAME },
+	{ "passthrough", "MSR_IA32_SPEC_CTRL", __MSR_IA32_SPEC_CTRL, MSR_READ | MSR_WRITE, WRITE_SAME },
+	{ "emulated", "MSR_IA32_TSCDEADLINE", __MSR_IA32_TSCDEADLINE, MSR_READ | MSR_WRITE, WRITE_DEADLINE },
+	{ "emulated", "X2APIC_TPR", __MSR_X2APIC_TPR, MSR_READ | MSR_WRITE, WRITE_SAME },
+	{ "emulated", "X2APIC_EOI", __MSR_X2APIC_EOI, MSR_WRITE, WRITE_ZERO },
+	{ "emulated", "X2APIC_ICR", __MSR_X2APIC_ICR, MSR_READ | MSR_WRITE, WRITE_SELF_IPI },
+	{ "emulated", "MSR_IA32_POWER_CTL", __MSR_IA32_POWER_CTL, MSR_READ | MSR_WRITE, WRITE_SAME },
+	{ "unsupported", "MSR_KVM_UNUSED", __MSR_KVM_UNUSED, MSR_READ | MSR_WRITE, WRITE_ZERO },
+	{ "pmu", "MSR_IA32_PMC0", __MSR_IA32_PMC0, MSR_READ | MSR_WRITE, WRITE_SAME },
+	{ "pmu", "MSR_CORE_PERF_FIXED_CTR0", __MSR_CORE_PERF_FIXED_CTR0, MSR_READ | MSR_WRITE, WRITE_SAME },
+	{ "pmu", "MSR_CORE_PERF_GLOBAL_CTRL", __MSR_CORE_PERF_GLOBAL_CTRL, MSR_READ | MSR_WRITE, WRITE_SAME },
+};
+
+static struct hist *h;
+
+static inline void msr_bench_report(struct msr_case *c, char *op, bool safe)
 {
-	printk(KERN_INFO "msr_bench: %s loop = %d, elapsed = %ld cycles, "
-			"average = %ld cycles\n", tag, LOOP, elapsed, elapsed / LOOP);
+	printk(KERN_INFO "msr_bench: %-11s %-26s 0x%08x %s %-4s loop = %d, average = %ld, "
+			"p50 = %ld, p99 = %ld, max = %ld cycles\n",
+			c->category, c->name, c->msr, op, safe ? "#GP" : "OK", LOOP, hist_avg(h),
+			hist_percentile(h, 50), hist_percentile(h, 99), h->max);
 }
 
-static inline int wrmsr_bench(char *tag, unsigned int msr, unsigned long val)
+static inline void msr_bench_report_skip(struct msr_case *c)
 {
+	printk(KERN_INFO "msr_bench: %-11s %-26s 0x%08x wrmsr skipped, rdmsr raises #GP, no value to write back\n",
+			c->category, c->name, c->msr);
+}
+
+/* check operation firstly, prefer to use asm instruction, fall back to the safe API on #GP */
+static bool rdmsr_loop(struct msr_case *c, struct hist *h)
+{
+	unsigned long start;
+	u64 val;
 	int loop;
+	bool safe = !!rdmsrl_safe(c->msr, &val);
+
+	memset(h, 0, sizeof(*h));
+	for (loop = LOOP; loop > 0; loop--) {
+		start = ins_rdtsc();
+		if (safe)
+			rdmsrl_safe(c->msr, &val);
+		else
+			ins_rdmsrl(c->msr);
+		hist_add(h, ins_rdtsc() - start);
+	}
+
+	return safe;
+}
+
+/* WRITE_SAME writes back the value read, nothing to write if the read raises #GP */
+static bool wrmsr_skip(struct msr_case *c)
+{
+	u64 val;
+
+	return (c->write == WRITE_SAME) && rdmsrl_safe(c->msr, &val);
+}
+
+static bool wrmsr_loop(struct msr_case *c, struct hist *h)
+{
+	unsigned long start;
+	u64 orig = 0, val;
 	u32 low, high;
+	int loop;
+	bool safe;
+
+	/* checked by wrmsr_skip() on the loading CPU, a parallel worker may still differ */
+	memset(h, 0, sizeof(*h));
+	if (rdmsrl_safe(c->msr, &orig) && (c->write == WRITE_SAME))
+		return true;
+
+	switch (c->write) {
+	case WRITE_SAME:
+		val = orig;
+		break;
+
+	case WRITE_DEADLINE:
+		/* a little long time, make sure no timer irq within test case
+		 * but val should less than 22s to avoid soft watchdog schedule.
+		 */
+		val = ins_rdtsc() + 10*1000*1000*1000UL;
+		break;
+
+	case WRITE_SELF_IPI:
+		val = __APIC_DEST_SELF | CALL_FUNCTION_SINGLE_VECTOR;
+		break;
+
+	default:
+		val = 0;
+		break;
+	}
 
 	low = val & 0xffffffffULL;
 	high = val >> 32;
+	safe = !!native_write_msr_safe(c->msr, low, high);
 
-	/* check operation firstly, prefer to use asm instruction */
-	if (native_write_msr_safe(msr, low, high) == 0) {
-		printk(KERN_INFO "msr_bench: wrmsr %s OK, "
-				"benchmark asm instrucion\n", tag);
+	for (loop = LOOP; loop > 0; loop--) {
+		start = ins_rdtsc();
+		if (safe)
+			native_write_msr_safe(c->msr, low, high);
+		else
+			ins_wrmsrl(c->msr, val);
+		hist_add(h, ins_rdtsc() - start);
+	}
 
-		/* bench loop */
-		for (loop = LOOP; loop > 0; loop--)
-			ins_wrmsrl(__MSR_IA32_TSCDEADLINE, val);
-	} else {
-		printk(KERN_INFO "msr_bench: wrmsr %s fail, "
-				"benchmark native safe API\n", tag);
+	/* give the deadline armed by kernel back, it fires at once if already expired */
+	if ((c->write == WRITE_DEADLINE) && !safe)
+		ins_wrmsrl(c->msr, orig);
+
+	return safe;
+}
+
+static void msr_bench(struct msr_case *c)
+{
+	unsigned long flags;
+	bool safe;
 
-		/* bench loop */
-		for (loop = LOOP; loop > 0; loop--)
-			native_write_msr_safe(msr, low, high);
+	/* interrupt handlers may touch the same MSRs, keep them out */
+	local_irq_save(flags);
+	if (c->ops & MSR_READ) {
+		safe = rdmsr_loop(c, h);
+		msr_bench_report(c, "rdmsr", safe);
 	}
 
-	return 0;
+	if ((c->ops & MSR_WRITE) && wrmsr_skip(c)) {
+		msr_bench_report_skip(c);
+	} else if (c->ops & MSR_WRITE) {
+		safe = wrmsr_loop(c, h);
+		msr_bench_report(c, "wrmsr", safe);
+	}
+	local_irq_restore(flags);
 }
 
-static int wrmsr_bench_tscdeadline(void)
+static void msr_bench_parallel_rdmsr(struct parallel_worker *pw)
 {
-	/* a little long time, make sure no timer irq within test case
-	 * but val should less than 22s to avoid soft watchdog schedule.
-	 */
-	unsigned long val = ins_rdtsc() + 10*1000*1000*1000UL;
+	unsigned long flags;
 
-	return wrmsr_bench("MSR_IA32_TSCDEADLINE", __MSR_IA32_TSCDEADLINE, val);
+	local_irq_save(flags);
+	rdmsr_loop(pw->arg, &pw->hist);
+	local_irq_restore(flags);
 }
 
-static int wrmsr_bench_power(void)
+static void msr_bench_parallel_wrmsr(struct parallel_worker *pw)
 {
-	/* kvm does not support this msr, just test vm-exit. */
-	unsigned long val = 0;
+	unsigned long flags;
 
-	return wrmsr_bench("MSR_IA32_POWER_CTL", __MSR_IA32_POWER_CTL, val);
+	local_irq_save(flags);
+	wrmsr_loop(pw->arg, &pw->hist);
+	local_irq_restore(flags);
 }
 
+/* the same operation on cpus=XX CPUs at the same time */
+static void msr_bench_parallel(struct msr_case *c)
+{
+	struct parallel_worker *workers;
+	char tag[64];
+	int nr;
+
+	if (c->ops & MSR_READ) {
+		nr = cpus;
+		workers = parallel_run("msr_bench", &nr, msr_bench_parallel_rdmsr, c);
+		if (workers) {
+			snprintf(tag, sizeof(tag), "%s 0x%08x rdmsr", c->name, c->msr);
+			parallel_report("msr_bench", tag, workers, nr);
+			vfree(workers);
+		}
+	}
+
+	if ((c->ops & MSR_WRITE) && wrmsr_skip(c)) {
+		msr_bench_report_skip(c);
+	} else if (c->ops & MSR_WRITE) {
+		nr = cpus;
+		workers = parallel_run("msr_bench", &nr, msr_bench_parallel_wrmsr, c);
+		if (workers) {
+			snprintf(tag, sizeof(tag), "%s 0x%08x wrmsr", c->name, c->msr);
+			parallel_report("msr_bench", tag, workers, nr);
+			vfree(workers);
+		}
+	}
+}
 
 static int msr_bench_init(void)
 {
-	unsigned long starttime, elapsed;
-	printk(KERN_INFO "msr_bench: %s start\n", __func__);
+	struct msr_case user = { "user", "user specified", 0, MSR_READ, WRITE_SAME };
+	void (*bench)(struct msr_case *c) = cpus > 0 ? msr_bench_parallel : msr_bench;
+	int i;
 
-	/* case MSR_IA32_POWER_CTL */
-	starttime = ins_rdtsc();
-	if (wrmsr_bench_power() == 0) {
+	printk(KERN_INFO "msr_bench: %s start\n", __func__);
 
-		elapsed = ins_rdtsc() - starttime;
-		msr_bench_report("MSR_IA32_POWER_CTL", elapsed);
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h) {
+		printk(KERN_INFO "msr_bench: no enough memory\n");
+		return -1;
 	}
 
-	/* case MSR_IA32_TSCDEADLINE */
-	starttime = ins_rdtsc();
-	if (wrmsr_bench_tscdeadline() == 0) {
+	/* the parallel workers are bound to their CPUs, the coordinator sleeps */
+	if (!cpus)
+		preempt_disable();
 
-		elapsed = ins_rdtsc() - starttime;
-		msr_bench_report("MSR_IA32_TSCDEADLINE", elapsed);
+	if (nr_msrs) {
+		if (wr)
+			user.ops |= MSR_WRITE;
+
+		for (i = 0; i < nr_msrs; i++) {
+			user.msr = msrs[i];
+			bench(&user);
+		}
+	} else {
+		for (i = 0; i < ARRAY_SIZE(cases); i++)
+			bench(&cases[i]);
 	}
 
+	if (!cpus)
+		preempt_enable();
+
+	kfree(h);
 	printk(KERN_INFO "msr_bench: %s finish\n", __func__);
 
 	return -1;
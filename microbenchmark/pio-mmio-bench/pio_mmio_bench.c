@@ -5,51 +5,221 @@
 #include <linux/kernel.h>
 #include <linux/io.h>
 #include <linux/ioport.h>
+#include <linux/pci.h>
+#include <linux/slab.h>
 #include "../common/rdtsc.h"
+#include "../common/hist.h"
+#include "../common/parallel.h"
+
+/* run each case on the first cpus=XX CPUs at the same time, 0 means the loading CPU only */
+static int cpus;
+module_param(cpus, int, 0444);
+
+/* explicit targets, benchmark them instead of the auto discovered devices */
+static unsigned int ports[16];
+static int nr_ports;
+module_param_array(ports, uint, &nr_ports, 0444);
+
+static unsigned long addrs[16];
+static int nr_addrs;
+module_param_array(addrs, ulong, &nr_addrs, 0444);
+
+/* a BAR of a PCI device, pci=0000:00:04.0 bar=XX offset=XX */
+static char *pci;
+module_param(pci, charp, 0444);
+
+static int bar;
+module_param(bar, int, 0444);
+
+static unsigned long offset;
+module_param(offset, ulong, 0444);
+
+/* access width in bytes: 1, 2, 4, 8(MMIO only), 0 means all of them */
+static int width = 1;
+module_param(width, int, 0444);
+
+/* also write value=XX to the explicit targets */
+static int write;
+module_param(write, int, 0444);
+
+static unsigned long value;
+module_param(value, ulong, 0444);
 
 #define LOOP 10000
 #define DEBUG(...)
 //#define DEBUG(fmt, ...) printk(fmt, ##__VA_ARGS__)
 
-static inline void pio_mmio_bench_report(char *tag, const char *name, unsigned long addr, unsigned long elapsed)
+struct pio_mmio_target {
+	char *tag;
+	const char *name;
+	unsigned long addr;
+	void *va;	/* NULL for PIO */
+	int width;
+	bool write;
+};
+
+static struct hist *h;
+
+static inline void pio_mmio_bench_report(struct pio_mmio_target *t)
 {
-	printk(KERN_INFO "pio_mmio_bench: %4s %18s, address = 0x%lx,  elapsed = %ld cycles, average = %ld cycles\n", tag, name, addr, elapsed, elapsed / LOOP);
+	printk(KERN_INFO "pio_mmio_bench: %4s %18s, address = 0x%lx, %-5s %d bytes, loop = %d, average = %ld, "
+			"p50 = %ld, p99 = %ld, max = %ld cycles\n", t->tag, t->name, t->addr,
+			t->write ? "write" : "read", t->width, LOOP, hist_avg(h), hist_percentile(h, 50),
+			hist_percentile(h, 99), h->max);
 }
 
-int pio_bench(char *tag, const char *name, unsigned long addr)
+static inline void pio_access(struct pio_mmio_target *t)
 {
+	switch (t->width) {
+	case 1:
+		if (t->write)
+			outb(value, t->addr);
+		else
+			inb(t->addr);
+		break;
+
+	case 2:
+		if (t->write)
+			outw(value, t->addr);
+		else
+			inw(t->addr);
+		break;
+
+	default:
+		if (t->write)
+			outl(value, t->addr);
+		else
+			inl(t->addr);
+		break;
+	}
+}
+
+static inline void mmio_access(struct pio_mmio_target *t)
+{
+	switch (t->width) {
+	case 1:
+		if (t->write)
+			writeb(value, t->va);
+		else
+			readb(t->va);
+		break;
+
+	case 2:
+		if (t->write)
+			writew(value, t->va);
+		else
+			readw(t->va);
+		break;
+
+	case 4:
+		if (t->write)
+			writel(value, t->va);
+		else
+			readl(t->va);
+		break;
+
+	default:
+		if (t->write)
+			writeq(value, t->va);
+		else
+			readq(t->va);
+		break;
+	}
+}
+
+static void pio_mmio_loop(struct pio_mmio_target *t, struct hist *h)
+{
+	unsigned long start;
 	int loop;
-	unsigned long starttime, elapsed;
 
-	starttime = ins_rdtsc();
+	memset(h, 0, sizeof(*h));
 	for (loop = LOOP; loop > 0; loop--) {
-		inb(addr);
+		start = ins_rdtsc();
+		if (t->va)
+			mmio_access(t);
+		else
+			pio_access(t);
+		hist_add(h, ins_rdtsc() - start);
 	}
+}
+
+static void pio_mmio_parallel(struct parallel_worker *pw)
+{
+	pio_mmio_loop(pw->arg, &pw->hist);
+}
 
-	elapsed = ins_rdtsc() - starttime;
+static void pio_mmio_bench_one(struct pio_mmio_target *t)
+{
+	struct parallel_worker *workers;
+	char buf[64];
+	int nr = cpus;
 
-	pio_mmio_bench_report(tag, name, addr, elapsed);
+	if (!cpus) {
+		pio_mmio_loop(t, h);
+		pio_mmio_bench_report(t);
+		return;
+	}
 
-	return 0;
+	workers = parallel_run("pio_mmio_bench", &nr, pio_mmio_parallel, t);
+	if (!workers)
+		return;
+
+	snprintf(buf, sizeof(buf), "%4s %18s 0x%lx %s %d bytes", t->tag, t->name, t->addr,
+			t->write ? "write" : "read", t->width);
+	parallel_report("pio_mmio_bench", buf, workers, nr);
+	vfree(workers);
 }
 
-int mmio_bench(char *tag, const char *name, unsigned long addr)
+/* run each selected width, writes only on the explicit targets */
+static void pio_mmio_bench(struct pio_mmio_target *t, bool explicit)
 {
-	int loop;
-	unsigned long starttime, elapsed;
-	void *va;
+	int w, max = t->va ? 8 : 4;
+
+	if (width > max) {
+		printk(KERN_INFO "pio_mmio_bench: %4s %18s, address = 0x%lx, no %d bytes access, skip\n",
+				t->tag, t->name, t->addr, width);
+		return;
+	}
 
-	va = ioremap(addr, 0x1000);
+	for (w = 1; w <= max; w <<= 1) {
+		if (width && (width != w))
+			continue;
 
-	starttime = ins_rdtsc();
-	for (loop = LOOP; loop > 0; loop--) {
-		readb((void*)va);
+		t->width = w;
+		t->write = false;
+		pio_mmio_bench_one(t);
+
+		if (explicit && write) {
+			t->write = true;
+			pio_mmio_bench_one(t);
+		}
 	}
+}
+
+int pio_bench(char *tag, const char *name, unsigned long addr, bool explicit)
+{
+	struct pio_mmio_target t = { .tag = tag, .name = name, .addr = addr };
+
+	pio_mmio_bench(&t, explicit);
+
+	return 0;
+}
 
-	elapsed = ins_rdtsc() - starttime;
+int mmio_bench(char *tag, const char *name, unsigned long addr, bool explicit)
+{
+	struct pio_mmio_target t = { .tag = tag, .name = name, .addr = addr };
+	void *va;
 
+	/* cover the widest access, it may cross the page */
+	va = ioremap(addr & PAGE_MASK, PAGE_ALIGN((addr & ~PAGE_MASK) + 8));
+	if (!va) {
+		printk(KERN_INFO "pio_mmio_bench: ioremap 0x%lx failed\n", addr);
+		return -1;
+	}
+
+	t.va = va + (addr & ~PAGE_MASK);
+	pio_mmio_bench(&t, explicit);
 	iounmap(va);
-	pio_mmio_bench_report(tag, name, addr, elapsed);
 
 	return 0;
 }
@@ -68,12 +238,12 @@ void pio_walk_resource(void)
 		if (!strcmp(res->name, "PCI Bus 0000:00")) {
 			for (tmp = res->child; tmp; tmp = tmp->sibling) {
 				DEBUG("pio_walk_resource name=%s, start=%llx, end=%llx\n", tmp->name, tmp->start, tmp->end);
-				if (!strcmp(tmp->name, "pic1") 
+				if (!strcmp(tmp->name, "pic1")
 						|| !(strcmp(tmp->name, "timer0"))) {
-					pio_bench("PIO", tmp->name, tmp->start);
+					pio_bench("PIO", tmp->name, tmp->start, false);
 				} else if (!strcmp(tmp->name, "keyboard")) {
-					pio_bench("PIO", "empty", tmp->start - 1);
-					pio_bench("PIO", tmp->name, tmp->start);
+					pio_bench("PIO", "empty", tmp->start - 1, false);
+					pio_bench("PIO", tmp->name, tmp->start, false);
 					break;
 				}
 			}
@@ -89,19 +259,19 @@ void mmio_walk_resource(void)
 		DEBUG("mmio_walk_resource name=%s, start=%llx, end=%llx\n", res->name, res->start, res->end);
 		if (!strcmp(res->name, "IOAPIC 0")
 				|| !strcmp(res->name, "Local APIC")) {
-			mmio_bench("MMIO", res->name, res->start);
+			mmio_bench("MMIO", res->name, res->start, false);
 		}
 		if (!strcmp(res->name, "PCI Bus 0000:00")) {
-			mmio_bench("MMIO", res->name, res->start);
+			mmio_bench("MMIO", res->name, res->start, false);
 			for (tmp = res->child; tmp; tmp = tmp->sibling) {
 				DEBUG("mmio_walk_resource PCI Bus name=%s, start=%llx, end=%llx\n", tmp->name, tmp->start, tmp->end);
 				if (tmp->child) {
 					DEBUG("mmio_walk_resource PCI Device name=%s, start=%llx, end=%llx\n", tmp->child->name, tmp->child->start, tmp->child->end);
 					if (strstr(tmp->child->name, "vram")) {
-						mmio_bench("MMIO", tmp->child->name, tmp->child->start);
+						mmio_bench("MMIO", tmp->child->name, tmp->child->start, false);
 					} else if (strstr(tmp->child->name, "virtio-pci-modern")) {
 						/* only bench the first virtio device */
-						mmio_bench("MMIO", tmp->child->name, tmp->child->start);
+						mmio_bench("MMIO", tmp->child->name, tmp->child->start, false);
 					}
 				}
 			}
@@ -109,13 +279,86 @@ void mmio_walk_resource(void)
 	}
 }
 
+/* pci=DDDD:BB:SS.F, benchmark BAR bar=XX at offset=XX */
+static int pci_bench(void)
+{
+	struct pci_dev *pdev;
+	unsigned int domain, bus, slot, func;
+	unsigned long start, len;
+	int ret = 0;
+
+	if (sscanf(pci, "%x:%x:%x.%x", &domain, &bus, &slot, &func) != 4) {
+		printk(KERN_INFO "pio_mmio_bench: invalid pci=%s, should be DDDD:BB:SS.F\n", pci);
+		return -1;
+	}
+
+	/* bar indexes pdev->resource[] */
+	if ((bar < 0) || (bar > PCI_STD_RESOURCE_END)) {
+		printk(KERN_INFO "pio_mmio_bench: invalid bar=%d, should be 0 - %d\n", bar, PCI_STD_RESOURCE_END);
+		return -1;
+	}
+
+	pdev = pci_get_domain_bus_and_slot(domain, bus, PCI_DEVFN(slot, func));
+	if (!pdev) {
+		printk(KERN_INFO "pio_mmio_bench: PCI device %s not found\n", pci);
+		return -1;
+	}
+
+	start = pci_resource_start(pdev, bar);
+	len = pci_resource_len(pdev, bar);
+	/* every selected width must fit, width=0 goes up to 8 bytes(4 bytes for PIO) */
+	if (!len || (offset + (width ? width : (pci_resource_flags(pdev, bar) & IORESOURCE_IO ? 4 : 8)) > len)) {
+		printk(KERN_INFO "pio_mmio_bench: offset 0x%lx width %d out of BAR%d(0x%lx bytes) of %s\n",
+				offset, width, bar, len, pci);
+		ret = -1;
+	} else if (pci_resource_flags(pdev, bar) & IORESOURCE_IO) {
+		pio_bench("PIO", pci, start + offset, true);
+	} else {
+		mmio_bench("MMIO", pci, start + offset, true);
+	}
+
+	pci_dev_put(pdev);
+
+	return ret;
+}
+
 static int pio_mmio_bench_init(void)
 {
+	int i;
+
 	printk(KERN_INFO "pio_mmio_bench: %s start\n", __func__);
 
-	pio_walk_resource();
-	mmio_walk_resource();
+	if ((width != 0) && (width != 1) && (width != 2) && (width != 4) && (width != 8)) {
+		printk(KERN_INFO "pio_mmio_bench: invalid width=%d, should be 0, 1, 2, 4 or 8\n", width);
+		return -1;
+	}
+
+	if ((width == 8) && nr_ports) {
+		printk(KERN_INFO "pio_mmio_bench: width=8 is MMIO only, invalid for ports\n");
+		return -1;
+	}
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h) {
+		printk(KERN_INFO "pio_mmio_bench: no enough memory\n");
+		return -1;
+	}
+
+	if (nr_ports || nr_addrs || pci) {
+		for (i = 0; i < nr_ports; i++)
+			pio_bench("PIO", "user specified", ports[i], true);
+
+		for (i = 0; i < nr_addrs; i++)
+			mmio_bench("MMIO", "user specified", addrs[i], true);
+
+		if (pci)
+			pci_bench();
+	} else {
+		pio_walk_resource();
+		mmio_walk_resource();
+	}
 
+	kfree(h);
 	printk(KERN_INFO "pio_mmio_bench: %s finish\n", __func__);
 
 	return -1;
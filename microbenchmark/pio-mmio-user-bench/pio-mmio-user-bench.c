@@ -0,0 +1,579 @@
+/*
+ * Copyright (C) 2021 zhenwei pi pizhenwei@bytedance.com.
+ *
+ * userspace variant of pio-mmio-bench, no kernel module required. PIO by
+ * ioperm(), MMIO by mmap of /sys/bus/pci/devices/XX/resourceN, or
+ * /dev/mem for the addresses outside of any PCI BAR. run it as root.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/io.h>
+#include <sys/mman.h>
+#include "../common/rdtsc.h"
+#include "../common/hist.h"
+
+#define print_err_and_exit(en, msg) \
+    do { errno = en; perror(msg); exit(EXIT_FAILURE); } while (0)
+
+#define PCI_DEVICES "/sys/bus/pci/devices"
+#define IORESOURCE_IO  0x100
+#define IORESOURCE_MEM 0x200
+#define PCI_STD_RESOURCE_END 5
+
+int loops = 10000;
+int width = 1;
+int do_write = 0;
+unsigned long value = 0;
+int num_threads = 0;
+long page_size;
+
+struct target {
+    const char *tag;
+    const char *name;
+    unsigned long addr;
+    volatile void *va;  /* NULL for PIO */
+    int width;
+    int write;
+};
+
+struct worker {
+    pthread_t thread_id;
+    int core_id;
+    struct target *t;
+    struct timespec start;
+    struct timespec finish;
+    struct hist hist;
+};
+
+pthread_barrier_t start_barrier;
+
+static inline void pio_access(struct target *t)
+{
+    switch (t->width) {
+        case 1:
+            if (t->write)
+                outb(value, t->addr);
+            else
+                inb(t->addr);
+            break;
+
+        case 2:
+            if (t->write)
+                outw(value, t->addr);
+            else
+                inw(t->addr);
+            break;
+
+        default:
+            if (t->write)
+                outl(value, t->addr);
+            else
+                inl(t->addr);
+            break;
+    }
+}
+
+static inline void mmio_access(struct target *t)
+{
+    switch (t->width) {
+        case 1:
+            if (t->write)
+                *(volatile unsigned char *)t->va = value;
+            else
+                (void)*(volatile unsigned char *)t->va;
+            break;
+
+        case 2:
+            if (t->write)
+                *(volatile unsigned short *)t->va = value;
+            else
+                (void)*(volatile unsigned short *)t->va;
+            break;
+
+        case 4:
+            if (t->write)
+                *(volatile unsigned int *)t->va = value;
+            else
+                (void)*(volatile unsigned int *)t->va;
+            break;
+
+        default:
+            if (t->write)
+                *(volatile unsigned long *)t->va = value;
+            else
+                (void)*(volatile unsigned long *)t->va;
+            break;
+    }
+}
+
+void bench_loop(struct target *t, struct hist *h)
+{
+    unsigned long start;
+    int loop;
+
+    memset(h, 0, sizeof(*h));
+    for (loop = loops; loop > 0; loop--) {
+        start = ins_rdtsc();
+        if (t->va)
+            mmio_access(t);
+        else
+            pio_access(t);
+        hist_add(h, ins_rdtsc() - start);
+    }
+}
+
+static inline long timespec_ns(struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000L + ts->tv_nsec;
+}
+
+void *__routine(void *arg)
+{
+    struct worker *worker = arg;
+    cpu_set_t cpuset;
+    int ret;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(worker->core_id, &cpuset);
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if (ret != 0) {
+        print_err_and_exit(ret, "pthread_setaffinity_np");
+    }
+
+    /* iopl()/ioperm() are per thread, inherited from the main thread at creation */
+    pthread_barrier_wait(&start_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &worker->start);
+    bench_loop(worker->t, &worker->hist);
+    clock_gettime(CLOCK_MONOTONIC, &worker->finish);
+
+    return NULL;
+}
+
+void report(struct target *t, const char *cpu, struct hist *h)
+{
+    printf("pio_mmio_bench: %4s %18s, address = 0x%lx, %-5s %d bytes, %sloop = %ld, average = %ld, "
+            "p50 = %ld, p99 = %ld, max = %ld cycles\n", t->tag, t->name, t->addr,
+            t->write ? "write" : "read", t->width, cpu, h->total, hist_avg(h),
+            hist_percentile(h, 50), hist_percentile(h, 99), h->max);
+}
+
+/* run on the first num_threads CPUs at the same time, report per-CPU and aggregate */
+void bench_parallel(struct target *t)
+{
+    struct worker *workers;
+    struct hist *all;
+    long start = -1, finish = 0, window;
+    char cpu[32];
+    int tnum, ret;
+
+    workers = calloc(num_threads, sizeof(struct worker));
+    all = calloc(1, sizeof(struct hist));
+    if (!workers || !all) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, num_threads);
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        workers[tnum].core_id = tnum;
+        workers[tnum].t = t;
+        ret = pthread_create(&workers[tnum].thread_id, NULL, __routine, &workers[tnum]);
+        if (ret != 0) {
+            print_err_and_exit(ret, "pthread_create");
+        }
+    }
+
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        ret = pthread_join(workers[tnum].thread_id, NULL);
+        if (ret != 0) {
+            print_err_and_exit(ret, "pthread_join");
+        }
+
+        snprintf(cpu, sizeof(cpu), "CPU[%3d] ", workers[tnum].core_id);
+        report(t, cpu, &workers[tnum].hist);
+        hist_merge(all, &workers[tnum].hist);
+        if (start < 0 || timespec_ns(&workers[tnum].start) < start)
+            start = timespec_ns(&workers[tnum].start);
+        if (timespec_ns(&workers[tnum].finish) > finish)
+            finish = timespec_ns(&workers[tnum].finish);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    window = finish > start ? finish - start : 1;
+    snprintf(cpu, sizeof(cpu), "%d CPUs ", num_threads);
+    report(t, cpu, all);
+    printf("pio_mmio_bench: %4s %18s, %d CPUs, window = %ld ns, throughput = %ld ops/s\n",
+            t->tag, t->name, num_threads, window, (long)(all->total * 1000000000.0 / window));
+
+    free(all);
+    free(workers);
+}
+
+void bench_one(struct target *t)
+{
+    struct hist *h;
+
+    if (num_threads > 0) {
+        bench_parallel(t);
+        return;
+    }
+
+    h = calloc(1, sizeof(struct hist));
+    if (!h) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    bench_loop(t, h);
+    report(t, "", h);
+    free(h);
+}
+
+/* run each selected width, writes only on the explicit targets */
+void bench_widths(struct target *t, int explicit)
+{
+    int w, max = t->va ? 8 : 4;
+
+    for (w = 1; w <= max; w <<= 1) {
+        if (width && (width != w))
+            continue;
+
+        t->width = w;
+        t->write = 0;
+        bench_one(t);
+
+        if (explicit && do_write) {
+            t->write = 1;
+            bench_one(t);
+        }
+    }
+}
+
+void pio_bench(const char *tag, const char *name, unsigned long port, int explicit)
+{
+    struct target t = { .tag = tag, .name = name, .addr = port };
+
+    /* ioperm() covers the whole 64K port space since linux 2.6.8 */
+    if (ioperm(port, 4, 1)) {
+        perror("ioperm");
+        return;
+    }
+
+    bench_widths(&t, explicit);
+}
+
+/* the widest access of bench_widths() */
+int max_width(int pio)
+{
+    if (width)
+        return width;
+
+    return pio ? 4 : 8;
+}
+
+/* enough pages for the widest access at addr, it may cross a page boundary */
+unsigned long map_len(unsigned long addr)
+{
+    return ((addr & (page_size - 1)) + max_width(0) + page_size - 1) & ~(page_size - 1);
+}
+
+/* find the PCI BAR containing addr, map it by the sysfs resource file */
+volatile void *pci_map(unsigned long addr, void **base)
+{
+    DIR *dir;
+    struct dirent *ent;
+    char path[512];
+    unsigned long start, end, flags, off;
+    volatile void *va = NULL;
+    FILE *fp;
+    int bar, fd;
+
+    dir = opendir(PCI_DEVICES);
+    if (!dir)
+        return NULL;
+
+    while (!va && (ent = readdir(dir))) {
+        if (ent->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), PCI_DEVICES "/%s/resource", ent->d_name);
+        fp = fopen(path, "r");
+        if (!fp)
+            continue;
+
+        for (bar = 0; bar < 6; bar++) {
+            if (fscanf(fp, "%lx %lx %lx", &start, &end, &flags) != 3)
+                break;
+
+            if (!(flags & IORESOURCE_MEM) || (addr < start) || (addr > end))
+                continue;
+
+            snprintf(path, sizeof(path), PCI_DEVICES "/%s/resource%d", ent->d_name, bar);
+            fd = open(path, O_RDWR | O_SYNC);
+            if (fd < 0) {
+                perror(path);
+                break;
+            }
+
+            off = (addr - start) & ~(page_size - 1);
+            *base = mmap(NULL, map_len(addr), PROT_READ | PROT_WRITE, MAP_SHARED, fd, off);
+            close(fd);
+            if (*base == MAP_FAILED) {
+                perror("mmap resource");
+                break;
+            }
+
+            va = (char *)*base + ((addr - start) & (page_size - 1));
+            break;
+        }
+
+        fclose(fp);
+    }
+
+    closedir(dir);
+
+    return va;
+}
+
+volatile void *devmem_map(unsigned long addr, void **base)
+{
+    int fd;
+
+    fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (fd < 0) {
+        perror("/dev/mem");
+        return NULL;
+    }
+
+    *base = mmap(NULL, map_len(addr), PROT_READ | PROT_WRITE, MAP_SHARED, fd, addr & ~(page_size - 1));
+    close(fd);
+    if (*base == MAP_FAILED) {
+        perror("mmap /dev/mem");
+        return NULL;
+    }
+
+    return (char *)*base + (addr & (page_size - 1));
+}
+
+void mmio_bench(const char *tag, const char *name, unsigned long addr, int explicit)
+{
+    struct target t = { .tag = tag, .name = name, .addr = addr };
+    void *base;
+
+    t.va = pci_map(addr, &base);
+    if (!t.va)
+        t.va = devmem_map(addr, &base);
+    if (!t.va) {
+        printf("pio_mmio_bench: map 0x%lx failed, skip %s\n", addr, name);
+        return;
+    }
+
+    bench_widths(&t, explicit);
+    munmap(base, map_len(addr));
+}
+
+/* pci=DDDD:BB:SS.F, benchmark BAR bar at offset, PIO or MMIO by BAR type */
+void pci_bench(const char *pci, int bar, unsigned long offset)
+{
+    char path[512];
+    unsigned long start = 0, end = 0, flags = 0;
+    FILE *fp;
+    int i;
+
+    if ((bar < 0) || (bar > PCI_STD_RESOURCE_END)) {
+        printf("pio_mmio_bench: invalid BAR%d of %s\n", bar, pci);
+        return;
+    }
+
+    snprintf(path, sizeof(path), PCI_DEVICES "/%s/resource", pci);
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return;
+    }
+
+    for (i = 0; i <= bar; i++) {
+        if (fscanf(fp, "%lx %lx %lx", &start, &end, &flags) != 3) {
+            flags = 0;
+            break;
+        }
+    }
+    fclose(fp);
+
+    if ((flags & IORESOURCE_IO) && (width == 8)) {
+        printf("pio_mmio_bench: PIO BAR%d of %s has no 8 bytes access\n", bar, pci);
+        return;
+    }
+
+    if (!flags || (offset > end - start)
+            || (max_width(flags & IORESOURCE_IO) > end - start - offset + 1)) {
+        printf("pio_mmio_bench: offset 0x%lx out of BAR%d of %s\n", offset, bar, pci);
+        return;
+    }
+
+    if (flags & IORESOURCE_IO)
+        pio_bench("PIO", pci, start + offset, 1);
+    else
+        mmio_bench("MMIO", pci, start + offset, 1);
+}
+
+/* the same devices as pio-mmio-bench, from /proc/ioports */
+void pio_walk_resource(void)
+{
+    char line[256], name[128];
+    unsigned long start, end;
+    FILE *fp;
+
+    fp = fopen("/proc/ioports", "r");
+    if (!fp) {
+        perror("/proc/ioports");
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%lx-%lx : %127[^\n]", &start, &end, name) != 3)
+            continue;
+
+        if (!strcmp(name, "pic1") || !strcmp(name, "timer0")) {
+            pio_bench("PIO", strdup(name), start, 0);
+        } else if (!strcmp(name, "keyboard")) {
+            pio_bench("PIO", "empty", start - 1, 0);
+            pio_bench("PIO", strdup(name), start, 0);
+            break;
+        }
+    }
+
+    fclose(fp);
+}
+
+/* the same devices as pio-mmio-bench, from /proc/iomem */
+void mmio_walk_resource(void)
+{
+    char line[256], name[128];
+    unsigned long start, end;
+    FILE *fp;
+
+    fp = fopen("/proc/iomem", "r");
+    if (!fp) {
+        perror("/proc/iomem");
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%lx-%lx : %127[^\n]", &start, &end, name) != 3)
+            continue;
+
+        if (!strcmp(name, "IOAPIC 0") || !strcmp(name, "Local APIC")
+                || !strcmp(name, "PCI Bus 0000:00")
+                || strstr(name, "vram") || strstr(name, "virtio-pci-modern")) {
+            mmio_bench("MMIO", strdup(name), start, 0);
+        }
+    }
+
+    fclose(fp);
+}
+
+void show_help()
+{
+    printf("Usage :\n");
+    printf("\t-p PORT : benchmark PIO port, repeatable\n");
+    printf("\t-a ADDR : benchmark MMIO physical address, repeatable\n");
+    printf("\t-d DDDD:BB:SS.F : benchmark a BAR of PCI device\n");
+    printf("\t-b BAR : BAR of -d, default 0\n");
+    printf("\t-o OFFSET : offset in BAR of -d, default 0\n");
+    printf("\t-w WIDTH : access width in bytes 1/2/4/8(MMIO only), 0 means all, default 1\n");
+    printf("\t-W VALUE : also write VALUE to the explicit targets\n");
+    printf("\t-l NUM : loops, default 10000\n");
+    printf("\t-n CPUs : run on the first CPUs at the same time\n");
+    printf("without -p/-a/-d, benchmark the devices found in /proc/ioports and /proc/iomem\n");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long ports[16], addrs[16], offset = 0;
+    int nr_ports = 0, nr_addrs = 0, bar = 0, opt, i;
+    char *pci = NULL;
+
+    while ((opt = getopt(argc, argv, "a:b:d:hl:n:o:p:w:W:")) != -1) {
+        switch (opt) {
+            case 'a':
+                if (nr_addrs < 16)
+                    addrs[nr_addrs++] = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'b':
+                bar = atoi(optarg);
+                break;
+
+            case 'd':
+                pci = optarg;
+                break;
+
+            case 'l':
+                loops = atoi(optarg);
+                break;
+
+            case 'n':
+                num_threads = atoi(optarg);
+                break;
+
+            case 'o':
+                offset = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'p':
+                if (nr_ports < 16)
+                    ports[nr_ports++] = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'w':
+                width = atoi(optarg);
+                if ((width != 0) && (width != 1) && (width != 2) && (width != 4) && (width != 8)) {
+                    printf("invalid width %s, 1/2/4/8 or 0\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'W':
+                do_write = 1;
+                value = strtoul(optarg, NULL, 0);
+                break;
+
+            default:
+                show_help();
+                return 0;
+        }
+    }
+
+    if (nr_ports && (width == 8)) {
+        printf("invalid width 8 for PIO, 1/2/4 or 0\n");
+        return -1;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+
+    if (nr_ports || nr_addrs || pci) {
+        for (i = 0; i < nr_ports; i++)
+            pio_bench("PIO", "user specified", ports[i], 1);
+
+        for (i = 0; i < nr_addrs; i++)
+            mmio_bench("MMIO", "user specified", addrs[i], 1);
+
+        if (pci)
+            pci_bench(pci, bar, offset);
+    } else {
+        pio_walk_resource();
+        mmio_walk_resource();
+    }
+
+    return 0;
+}
@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2021 zhenwei pi pizhenwei@bytedance.com.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kallsyms.h>
+#include <linux/irq_work.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <asm/kvm_para.h>
+#include <asm/pvclock.h>
+#include <asm/tlbflush.h>
+#include <asm/msr.h>
+#include <asm/io.h>
+#include "../common/rdtsc.h"
+
+static int options;
+module_param(options, int, 0444);
+
+#define LOOP 100000
+#define CLOCK_ROUNDS 1000
+
+#define PV_HYPERCALL	(1<<0)
+#define PV_KVMCLOCK	(1<<1)
+#define PV_STEALTIME	(1<<2)
+#define PV_EOI		(1<<3)
+#define PV_TLBFLUSH	(1<<4)
+
+static char *benchcases[] = {
+	"hypercall: VMCALL round trip of KVM_HC_VAPIC_POLL_IRQ which does nothing.",
+	"kvmclock: pvclock read cost compared with rdtsc, and monotonicity walking across all the vCPUs.",
+	"stealtime: steal time record read cost.",
+	"pv-eoi: self IPI round trip with PV EOI enabled and disabled on the loading vCPU.",
+	"pv-tlbflush: TLB flush to all the other vCPUs by kvm PV flush and by native IPI flush.",
+};
+
+static char *features[] = {
+	[KVM_FEATURE_CLOCKSOURCE]	= "CLOCKSOURCE",
+	[KVM_FEATURE_NOP_IO_DELAY]	= "NOP_IO_DELAY",
+	[KVM_FEATURE_MMU_OP]		= "MMU_OP",
+	[KVM_FEATURE_CLOCKSOURCE2]	= "CLOCKSOURCE2",
+	[KVM_FEATURE_ASYNC_PF]		= "ASYNC_PF",
+	[KVM_FEATURE_STEAL_TIME]	= "STEAL_TIME",
+	[KVM_FEATURE_PV_EOI]		= "PV_EOI",
+	[KVM_FEATURE_PV_UNHALT]		= "PV_UNHALT",
+	[KVM_FEATURE_PV_TLB_FLUSH]	= "PV_TLB_FLUSH",
+	[KVM_FEATURE_ASYNC_PF_VMEXIT]	= "ASYNC_PF_VMEXIT",
+	[KVM_FEATURE_PV_SEND_IPI]	= "PV_SEND_IPI",
+};
+
+static unsigned int kvm_features;
+
+static inline void pv_bench_report(char *tag, int loop, unsigned long elapsed)
+{
+	printk(KERN_INFO "pv_bench: %s loop = %d, elapsed = %ld cycles, "
+			"average = %ld cycles\n", tag, loop, elapsed, elapsed / loop);
+}
+
+static inline bool pv_bench_has(int feature)
+{
+	return !!(kvm_features & (1 << feature));
+}
+
+/* look for the KVM signature in the hypervisor CPUID leaves, like kvm_cpuid_base() */
+static unsigned int pv_bench_cpuid_base(void)
+{
+	unsigned int base, eax, signature[3];
+
+	if (!boot_cpu_has(X86_FEATURE_HYPERVISOR))
+		return 0;
+
+	for (base = KVM_CPUID_SIGNATURE; base < KVM_CPUID_SIGNATURE + 0x10000; base += 0x100) {
+		cpuid(base, &eax, &signature[0], &signature[1], &signature[2]);
+		if (!memcmp("KVMKVMKVM\0\0\0", signature, 12))
+			return base;
+	}
+
+	return 0;
+}
+
+static int pv_bench_features(void)
+{
+	unsigned int base = pv_bench_cpuid_base();
+	int i;
+
+	if (!base) {
+		printk(KERN_INFO "pv_bench: not running on KVM\n");
+		return -1;
+	}
+
+	kvm_features = cpuid_eax(base | KVM_CPUID_FEATURES);
+	printk(KERN_INFO "pv_bench: KVM CPUID base 0x%x, features 0x%x\n", base, kvm_features);
+	for (i = 0; i < ARRAY_SIZE(features); i++) {
+		if (features[i] && pv_bench_has(i))
+			printk(KERN_INFO "pv_bench:\t%s\n", features[i]);
+	}
+
+	return 0;
+}
+
+static void pv_bench_hypercall(void)
+{
+	unsigned long starttime, elapsed;
+	int loop;
+
+	starttime = ins_rdtsc();
+	for (loop = LOOP; loop > 0; loop--)
+		kvm_hypercall0(KVM_HC_VAPIC_POLL_IRQ);
+
+	elapsed = ins_rdtsc() - starttime;
+	pv_bench_report("VMCALL KVM_HC_VAPIC_POLL_IRQ", LOOP, elapsed);
+}
+
+/* the pvclock of this vCPU, registered by the guest kernel */
+static struct pvclock_vcpu_time_info *pv_bench_pvclock(void)
+{
+	u64 msr;
+
+	if (rdmsrl_safe(MSR_KVM_SYSTEM_TIME_NEW, &msr) || !(msr & KVM_MSR_ENABLED))
+		return NULL;
+
+	return phys_to_virt(msr & ~(u64)KVM_MSR_ENABLED);
+}
+
+/* same as pvclock_clocksource_read(), which is not exported */
+static u64 pv_bench_pvclock_read(struct pvclock_vcpu_time_info *src)
+{
+	unsigned int version;
+	u64 ns, delta;
+
+	do {
+		version = READ_ONCE(src->version);
+		virt_rmb();
+		delta = rdtsc_ordered() - src->tsc_timestamp;
+		ns = src->system_time + pvclock_scale_delta(delta, src->tsc_to_system_mul, src->tsc_shift);
+		virt_rmb();
+	} while ((version & 1) || (version != READ_ONCE(src->version)));
+
+	return ns;
+}
+
+struct clock_walk {
+	u64 last;		/* the last reading of the previous vCPU */
+	u64 backward;		/* times going backward */
+	u64 max_backward;	/* max backward in ns */
+	int unregistered;	/* vCPUs without pvclock */
+};
+
+static void pv_bench_clock_walk(void *info)
+{
+	struct clock_walk *walk = info;
+	struct pvclock_vcpu_time_info *src = pv_bench_pvclock();
+	u64 now;
+
+	if (!src) {
+		walk->unregistered++;
+		return;
+	}
+
+	now = pv_bench_pvclock_read(src);
+	if (now < walk->last) {
+		walk->backward++;
+		walk->max_backward = max(walk->max_backward, walk->last - now);
+	}
+
+	walk->last = now;
+}
+
+static void pv_bench_kvmclock(void)
+{
+	struct pvclock_vcpu_time_info *src;
+	struct clock_walk walk = { 0 };
+	unsigned long starttime, elapsed;
+	int loop, cpu;
+
+	if (!pv_bench_has(KVM_FEATURE_CLOCKSOURCE2)) {
+		printk(KERN_INFO "pv_bench: no KVM_FEATURE_CLOCKSOURCE2, skip kvmclock\n");
+		return;
+	}
+
+	preempt_disable();
+	src = pv_bench_pvclock();
+	if (!src) {
+		preempt_enable();
+		printk(KERN_INFO "pv_bench: kvmclock is not registered, skip kvmclock\n");
+		return;
+	}
+
+	printk(KERN_INFO "pv_bench: pvclock flags 0x%x, TSC stable %d\n", src->flags,
+			!!(src->flags & PVCLOCK_TSC_STABLE_BIT));
+
+	starttime = ins_rdtsc();
+	for (loop = LOOP; loop > 0; loop--)
+		pv_bench_pvclock_read(src);
+
+	elapsed = ins_rdtsc() - starttime;
+	pv_bench_report("pvclock read", LOOP, elapsed);
+
+	starttime = ins_rdtsc();
+	for (loop = LOOP; loop > 0; loop--)
+		rdtsc_ordered();
+
+	elapsed = ins_rdtsc() - starttime;
+	pv_bench_report("rdtsc_ordered", LOOP, elapsed);
+	preempt_enable();
+
+	/* read pvclock on each vCPU in turn, the time should never go backward */
+	for (loop = CLOCK_ROUNDS; loop > 0; loop--) {
+		for_each_online_cpu(cpu)
+			smp_call_function_single(cpu, pv_bench_clock_walk, &walk, 1);
+	}
+
+	printk(KERN_INFO "pv_bench: pvclock walk %d rounds across %d vCPUs, backward %llu times, "
+			"max backward %llu ns, unregistered %d\n", CLOCK_ROUNDS, num_online_cpus(),
+			walk.backward, walk.max_backward, walk.unregistered / CLOCK_ROUNDS);
+}
+
+/* same as kvm_steal_clock(), which is not exported */
+static u64 pv_bench_steal_read(struct kvm_steal_time *st)
+{
+	unsigned int version;
+	u64 steal;
+
+	do {
+		version = READ_ONCE(st->version);
+		virt_rmb();
+		steal = READ_ONCE(st->steal);
+		virt_rmb();
+	} while ((version & 1) || (version != READ_ONCE(st->version)));
+
+	return steal;
+}
+
+static void pv_bench_stealtime(void)
+{
+	struct kvm_steal_time *st;
+	unsigned long starttime, elapsed;
+	u64 msr, steal;
+	int loop;
+
+	if (!pv_bench_has(KVM_FEATURE_STEAL_TIME)) {
+		printk(KERN_INFO "pv_bench: no KVM_FEATURE_STEAL_TIME, skip stealtime\n");
+		return;
+	}
+
+	preempt_disable();
+	if (rdmsrl_safe(MSR_KVM_STEAL_TIME, &msr) || !(msr & KVM_MSR_ENABLED)) {
+		preempt_enable();
+		printk(KERN_INFO "pv_bench: steal time is not registered, skip stealtime\n");
+		return;
+	}
+
+	st = phys_to_virt(msr & KVM_STEAL_VALID_BITS);
+	steal = pv_bench_steal_read(st);
+
+	starttime = ins_rdtsc();
+	for (loop = LOOP; loop > 0; loop--)
+		pv_bench_steal_read(st);
+
+	elapsed = ins_rdtsc() - starttime;
+	steal = pv_bench_steal_read(st) - steal;
+	preempt_enable();
+
+	pv_bench_report("steal time read", LOOP, elapsed);
+	printk(KERN_INFO "pv_bench: steal time %llu ns during the loop\n", steal);
+}
+
+static int irq_work_done;
+
+static void pv_bench_irq_work_func(struct irq_work *work)
+{
+	WRITE_ONCE(irq_work_done, 1);
+}
+
+/* self IPI by irq work, the handler ends with EOI */
+static unsigned long pv_bench_self_ipi(void)
+{
+	struct irq_work work;
+	unsigned long starttime;
+	int loop;
+
+	init_irq_work(&work, pv_bench_irq_work_func);
+
+	starttime = ins_rdtsc();
+	for (loop = LOOP; loop > 0; loop--) {
+		WRITE_ONCE(irq_work_done, 0);
+		irq_work_queue(&work);
+		while (!READ_ONCE(irq_work_done))
+			cpu_relax();
+	}
+
+	return ins_rdtsc() - starttime;
+}
+
+static void pv_bench_pv_eoi(void)
+{
+	unsigned long elapsed, flags;
+	u64 msr;
+
+	if (!pv_bench_has(KVM_FEATURE_PV_EOI)) {
+		printk(KERN_INFO "pv_bench: no KVM_FEATURE_PV_EOI, skip pv-eoi\n");
+		return;
+	}
+
+	preempt_disable();
+	if (rdmsrl_safe(MSR_KVM_PV_EOI_EN, &msr) || !(msr & KVM_MSR_ENABLED)) {
+		preempt_enable();
+		printk(KERN_INFO "pv_bench: PV EOI is not enabled by guest, skip pv-eoi\n");
+		return;
+	}
+
+	elapsed = pv_bench_self_ipi();
+	pv_bench_report("self IPI with PV EOI", LOOP, elapsed);
+
+	/* no interrupt is in service here, it's safe to switch PV EOI off and on */
+	local_irq_save(flags);
+	wrmsrl(MSR_KVM_PV_EOI_EN, 0);
+	local_irq_restore(flags);
+
+	elapsed = pv_bench_self_ipi();
+
+	local_irq_save(flags);
+	wrmsrl(MSR_KVM_PV_EOI_EN, msr);
+	local_irq_restore(flags);
+	preempt_enable();
+
+	pv_bench_report("self IPI with regular EOI", LOOP, elapsed);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+#define PV_FLUSH_FUNC		"kvm_flush_tlb_multi"
+#define NATIVE_FLUSH_FUNC	"native_flush_tlb_multi"
+#else
+#define PV_FLUSH_FUNC		"kvm_flush_tlb_others"
+#define NATIVE_FLUSH_FUNC	"native_flush_tlb_others"
+#endif
+
+typedef void (*flush_tlb_t)(const struct cpumask *cpumask, const struct flush_tlb_info *info);
+
+static void pv_bench_flush(char *func, const struct cpumask *mask)
+{
+	struct flush_tlb_info info = {
+		.mm = NULL,
+		.start = 0,
+		.end = TLB_FLUSH_ALL,
+	};
+	unsigned long starttime, elapsed;
+	flush_tlb_t flush;
+	int loop;
+
+	flush = (flush_tlb_t)kallsyms_lookup_name(func);
+	if (!flush) {
+		printk(KERN_INFO "pv_bench: %s not found, skip\n", func);
+		return;
+	}
+
+	starttime = ins_rdtsc();
+	for (loop = LOOP; loop > 0; loop--)
+		flush(mask, &info);
+
+	elapsed = ins_rdtsc() - starttime;
+	pv_bench_report(func, LOOP, elapsed);
+}
+
+/*
+ * PV flush skips the preempted vCPUs and asks KVM to flush for them, so it
+ * only pays off when some vCPUs of the mask are preempted.
+ */
+static void pv_bench_pv_tlbflush(void)
+{
+	cpumask_var_t mask;
+
+	if (!pv_bench_has(KVM_FEATURE_PV_TLB_FLUSH))
+		printk(KERN_INFO "pv_bench: no KVM_FEATURE_PV_TLB_FLUSH, PV flush degrades to IPI flush\n");
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL)) {
+		printk(KERN_INFO "pv_bench: no enough memory\n");
+		return;
+	}
+
+	preempt_disable();
+	cpumask_copy(mask, cpu_online_mask);
+	cpumask_clear_cpu(smp_processor_id(), mask);
+	if (cpumask_empty(mask)) {
+		printk(KERN_INFO "pv_bench: single vCPU, skip pv-tlbflush\n");
+	} else {
+		pv_bench_flush(PV_FLUSH_FUNC, mask);
+		pv_bench_flush(NATIVE_FLUSH_FUNC, mask);
+	}
+	preempt_enable();
+
+	free_cpumask_var(mask);
+}
+
+static int pv_bench_init(void)
+{
+	int i;
+
+	if (!options) {
+		printk(KERN_INFO "pv_bench: you should run insmod pv_bench.ko options=XX, bit flags:\n");
+		for (i = 0; i < ARRAY_SIZE(benchcases); i++) {
+			printk(KERN_INFO "pv_bench:\tbit[%d] %s\n", i, benchcases[i]);
+		}
+
+		return -1;
+	}
+
+	if (pv_bench_features() < 0)
+		return -1;
+
+	if (options & PV_HYPERCALL)
+		pv_bench_hypercall();
+
+	if (options & PV_KVMCLOCK)
+		pv_bench_kvmclock();
+
+	if (options & PV_STEALTIME)
+		pv_bench_stealtime();
+
+	if (options & PV_EOI)
+		pv_bench_pv_eoi();
+
+	if (options & PV_TLBFLUSH)
+		pv_bench_pv_tlbflush();
+
+	return -1;
+}
+
+static void pv_bench_exit(void)
+{
+	/* should never run */
+	printk(KERN_INFO "pv_bench: %s\n", __func__);
+}
+
+module_init(pv_bench_init);
+module_exit(pv_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("zhenwei pi pizhewnei@bytedance.com");
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2021 zhenwei pi pizhenwei@bytedance.com.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/slab.h>
+#include <asm/apic.h>
+#include <asm/hardirq.h>
+#include <asm/msr.h>
+#include <asm/tsc.h>
+#include "../common/rdtsc.h"
+#include "../common/hist.h"
+
+static int options;
+module_param(options, int, 0444);
+
+/* timer offsets from arming to expiry, in ns */
+static unsigned long offsets[16] = { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 1000000 };
+static int nr_offsets = 8;
+module_param_array(offsets, ulong, &nr_offsets, 0444);
+
+/* shots of each offset */
+static int shots = 1000;
+module_param(shots, int, 0444);
+
+/* wait for the timer by spinning(0) or by halting(1) */
+static int halt;
+module_param(halt, int, 0444);
+
+#define TIMER_DEADLINE	(1<<0)
+#define TIMER_HRTIMER	(1<<1)
+
+static char *benchcases[] = {
+	"tsc-deadline: arm MSR_IA32_TSCDEADLINE directly, poll the APIC timer interrupt counter for the delivery.",
+	"hrtimer: arm a pinned hard irq hrtimer, record TSC in the callback.",
+};
+
+struct timer_shot {
+	struct hrtimer timer;
+	unsigned long fired;
+	int done;
+};
+
+static inline unsigned long ns_to_cycles(unsigned long ns)
+{
+	return ns * tsc_khz / 1000000;
+}
+
+static inline unsigned long cycles_to_ns(unsigned long cycles)
+{
+	return cycles * 1000000 / tsc_khz;
+}
+
+static void timer_bench_report(char *tag, unsigned long offset, struct hist *h, int skipped, int early)
+{
+	printk(KERN_INFO "timer_bench: %-12s offset = %7ld ns, shots = %ld, skipped = %d, early = %d, "
+			"lateness average = %ld, p50 = %ld, p90 = %ld, p99 = %ld, max = %ld ns\n",
+			tag, offset, h->total, skipped, early, cycles_to_ns(hist_avg(h)),
+			cycles_to_ns(hist_percentile(h, 50)), cycles_to_ns(hist_percentile(h, 90)),
+			cycles_to_ns(hist_percentile(h, 99)), cycles_to_ns(h->max));
+}
+
+/* wait until cond becomes true, irq is enabled on return */
+#define timer_bench_wait(cond)				\
+do {							\
+	while (!(cond)) {				\
+		if (halt) {				\
+			local_irq_disable();		\
+			if (!(cond))			\
+				safe_halt();		\
+			else				\
+				local_irq_enable();	\
+		} else {				\
+			cpu_relax();			\
+		}					\
+	}						\
+} while (0)
+
+/*
+ * the kernel owns MSR_IA32_TSCDEADLINE as clock event device. arm an earlier
+ * deadline only, the interrupt runs hrtimer_interrupt() which finds nothing
+ * expired and reprograms the deadline of the kernel, so nothing gets lost.
+ */
+static int timer_bench_deadline_one(unsigned long offset, unsigned long *late)
+{
+	unsigned long flags, deadline, now;
+	u64 armed;
+	unsigned int irqs;
+
+	local_irq_save(flags);
+	rdmsrl(MSR_IA32_TSC_DEADLINE, armed);
+	deadline = ins_rdtsc() + offset;
+	if (armed && (armed < deadline)) {
+		local_irq_restore(flags);
+		return -EAGAIN;
+	}
+
+	irqs = this_cpu_read(irq_stat.apic_timer_irqs);
+	wrmsrl(MSR_IA32_TSC_DEADLINE, deadline);
+	local_irq_restore(flags);
+
+	timer_bench_wait(this_cpu_read(irq_stat.apic_timer_irqs) != irqs);
+	now = ins_rdtsc();
+
+	if (now < deadline)
+		return -ERANGE;
+
+	*late = now - deadline;
+
+	return 0;
+}
+
+static void timer_bench_deadline(struct hist *h)
+{
+	unsigned long offset, late;
+	int i, shot, tries, skipped, early, ret;
+
+	if (!boot_cpu_has(X86_FEATURE_TSC_DEADLINE_TIMER)) {
+		printk(KERN_INFO "timer_bench: no TSC deadline timer, skip tsc-deadline\n");
+		return;
+	}
+
+	if ((apic_read(APIC_LVTT) & APIC_LVT_TIMER_MASK) != APIC_LVT_TIMER_TSCDEADLINE) {
+		printk(KERN_INFO "timer_bench: APIC timer is not in TSC deadline mode, skip tsc-deadline\n");
+		return;
+	}
+
+	for (i = 0; i < nr_offsets; i++) {
+		offset = ns_to_cycles(offsets[i]);
+		memset(h, 0, sizeof(*h));
+		skipped = early = 0;
+
+		/* give up if the kernel keeps arming earlier deadlines */
+		for (shot = 0, tries = 0; (shot < shots) && (tries < shots * 4); tries++) {
+			ret = timer_bench_deadline_one(offset, &late);
+			if (ret == -EAGAIN) {
+				skipped++;
+				continue;
+			}
+
+			if (ret == -ERANGE) {
+				early++;
+				late = 0;
+			}
+
+			hist_add(h, late);
+			shot++;
+		}
+
+		timer_bench_report("tsc-deadline", offsets[i], h, skipped, early);
+	}
+}
+
+static enum hrtimer_restart timer_bench_hrtimer_fn(struct hrtimer *timer)
+{
+	struct timer_shot *ts = container_of(timer, struct timer_shot, timer);
+
+	ts->fired = ins_rdtsc();
+	WRITE_ONCE(ts->done, 1);
+
+	return HRTIMER_NORESTART;
+}
+
+static void timer_bench_hrtimer(struct hist *h)
+{
+	struct timer_shot ts;
+	unsigned long expect;
+	int i, shot, early;
+
+	hrtimer_init_on_stack(&ts.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED_HARD);
+	ts.timer.function = timer_bench_hrtimer_fn;
+
+	for (i = 0; i < nr_offsets; i++) {
+		memset(h, 0, sizeof(*h));
+		early = 0;
+
+		for (shot = 0; shot < shots; shot++) {
+			ts.done = 0;
+			expect = ins_rdtsc() + ns_to_cycles(offsets[i]);
+			hrtimer_start(&ts.timer, ns_to_ktime(offsets[i]), HRTIMER_MODE_REL_PINNED_HARD);
+			timer_bench_wait(READ_ONCE(ts.done));
+
+			if (ts.fired < expect) {
+				early++;
+				hist_add(h, 0);
+			} else {
+				hist_add(h, ts.fired - expect);
+			}
+		}
+
+		timer_bench_report("hrtimer", offsets[i], h, 0, early);
+	}
+
+	hrtimer_cancel(&ts.timer);
+	destroy_hrtimer_on_stack(&ts.timer);
+}
+
+static int timer_bench_init(void)
+{
+	struct hist *h;
+	int i;
+
+	if (!options) {
+		printk(KERN_INFO "timer_bench: you should run insmod timer_bench.ko options=XX, bit flags:\n");
+		for (i = 0; i < ARRAY_SIZE(benchcases); i++) {
+			printk(KERN_INFO "timer_bench:\tbit[%d] %s\n", i, benchcases[i]);
+		}
+
+		return -1;
+	}
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h) {
+		printk(KERN_INFO "timer_bench: no enough memory\n");
+		return -1;
+	}
+
+	printk(KERN_INFO "timer_bench: %s start on CPU %d, running on %s, wait by %s\n", __func__,
+			get_cpu(), boot_cpu_has(X86_FEATURE_HYPERVISOR) ? "guest" : "bare metal",
+			halt ? "halt" : "spin");
+
+	if (options & TIMER_DEADLINE)
+		timer_bench_deadline(h);
+
+	if (options & TIMER_HRTIMER)
+		timer_bench_hrtimer(h);
+
+	put_cpu();
+
+	printk(KERN_INFO "timer_bench: %s finish\n", __func__);
+	kfree(h);
+
+	return -1;
+}
+
+static void timer_bench_exit(void)
+{
+	/* should never run */
+	printk(KERN_INFO "timer_bench: %s\n", __func__);
+}
+
+module_init(timer_bench_init);
+module_exit(timer_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("zhenwei pi pizhewnei@bytedance.com");
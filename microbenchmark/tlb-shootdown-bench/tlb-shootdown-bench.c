@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #define __USE_GNU
 #include <sched.h>
 #include <errno.h>
@@ -8,9 +9,19 @@
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <cpuid.h>
+#include <sys/utsname.h>
+#include "../common/rdtsc.h"
+#include "../common/hist.h"
 
 pid_t __gettid();
 suseconds_t __time_diff();
+unsigned long __now_ns();
 
 #define print_err_and_exit(en, msg) \
     do { errno = en; perror(msg); exit(EXIT_FAILURE); } while (0)
@@ -18,12 +29,159 @@ suseconds_t __time_diff();
 #define TRACE() \
     do { printf("[TID %d]TRACE : %s\n", __gettid(), __func__); } while(0);
 
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+#ifndef __NR_process_madvise
+#define __NR_process_madvise 440
+#endif
+
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21
+#endif
+
+#define IOV_BATCH 1024  /* UIO_MAXIOV */
+
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
+
+#define __MPOL_BIND       2
+#define __MPOL_MF_MOVE    (1 << 1)
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define PAGE_4K     (4096UL)
+#define PAGE_2M     (2UL << 20)
+#define PAGE_1G     (1UL << 30)
 
 unsigned long buf_size = 256*1024*1024; //64M
 int bench_loops = 1;
 int use_unmap = 0;
-int use_interleave = 0;
 
+/* CPU of each thread, by the placement policy */
+#define PLACE_LINEAR     0
+#define PLACE_INTERLEAVE 1
+#define PLACE_COMPACT    2
+#define PLACE_SCATTER    3
+#define PLACE_SMT        4
+#define PLACE_LLC        5
+int place_policy = PLACE_LINEAR;
+const char *place_policies[] = { "linear", "interleave", "compact", "scatter", "smt", "llc" };
+int *placement;
+int num_cpus;
+
+struct cpu_topo {
+    int cpu;
+    int package;
+    int core;
+    int thread;     /* index in the SMT siblings */
+    int llc;        /* the first CPU sharing the LLC */
+    int llc_rank;   /* index in the LLC */
+};
+
+/* one row of the scaling table */
+struct result {
+    int procs;
+    int threads;    /* per process */
+    int bystanders; /* per process */
+    int bystander_mode;
+    unsigned long range;
+    unsigned long calls;
+    unsigned long avg;
+    unsigned long p50;
+    unsigned long p90;
+    unsigned long p99;
+    unsigned long max;
+    unsigned long ipis;
+    double ipis_per_op;
+    suseconds_t fill_usec;  /* sum of the workers */
+    suseconds_t leak_usec;  /* sum of the workers */
+    unsigned long pages;    /* invalidated by all the workers */
+    double pages_per_sec;   /* the workers run at the same time, the rates add up */
+    double ns_per_page;
+    double shootdowns_per_sec;
+};
+
+/* backing of the buffer: 4K pages, THP, hugetlb 2M or 1G */
+#define MAP_4K      0
+#define MAP_THP     1
+#define MAP_2M      2
+#define MAP_1G      3
+int map_mode = MAP_4K;
+const char *map_modes[] = { "4k", "thp", "2m", "1g" };
+unsigned long map_page_size = PAGE_4K;
+
+/* madvise range of each call, swept by -s/-S */
+unsigned long range_size = 4096;
+unsigned long range_sizes[64];
+int num_range_sizes = 0;
+
+/* the memory operation which triggers the shootdown of a range */
+#define TRIGGER_DONTNEED    0
+#define TRIGGER_FREE        1
+#define TRIGGER_MPROTECT    2
+#define TRIGGER_MREMAP      3
+#define TRIGGER_MIGRATE     4
+#define TRIGGER_MBIND       5
+#define TRIGGER_COW         6
+int trigger = TRIGGER_DONTNEED;
+const char *triggers[] = { "dontneed", "free", "mprotect", "mremap", "migrate", "mbind", "cow" };
+int num_nodes = 1;
+
+/* cow: one child per loop for all the workers of a process, forked by the first worker */
+pthread_barrier_t cow_barrier;
+struct thread_info *cow_leader;
+pid_t cow_child;
+
+/* batch the ranges by process_madvise(), fall back to MADV_PAGEOUT if MADV_DONTNEED is refused */
+int use_process_madvise = 0;
+int pidfd = -1;
+int pmadv_advice = MADV_DONTNEED;
+
+/* victim mode: initiators madvise at each rate, victims record the time stolen from them */
+int num_victims = 0;
+int rates[16] = { 0, 1000, 10000, 100000 };
+int num_rates = 4;
+int duration_ms = 1000;
+unsigned long gap_ns = 500;
+double tsc_per_ns;
+volatile int stop_run;
+
+/*
+ * bystanders: a part of the threads sharing the mm, they don't flush but stay
+ * on their CPUs busy(same mm), sleeping(idle, lazy TLB, a halted vCPU in a
+ * guest) or sleeping while another process spins on the CPU(other mm).
+ */
+#define BYSTANDER_BUSY  0
+#define BYSTANDER_SLEEP 1
+#define BYSTANDER_OTHER 2
+const char *bystander_modes[] = { "busy", "sleep", "other" };
+int bystander_pct = 0;
+int bystander_list[3] = { BYSTANDER_SLEEP };
+int num_bystander_list = 1;
+int bystander_mode = BYSTANDER_SLEEP;
+int bystander_pipe[2];
+
+/* daemon mode: sustain daemon_rate shootdowns/s in total, a noisy neighbor for other tenants */
+int daemon_rate = -1;
+int report_ms = 1000;
+char *cpu_list;
+#define DAEMON_BURST_MS 10      /* token bucket depth */
+#define DAEMON_SPIN_NS  50000   /* spin instead of sleep for shorter waits */
+
+/* machine readable records, the text output moves to stderr if they go to stdout */
+#define OUT_TEXT 0
+#define OUT_JSON 1
+#define OUT_CSV  2
+const char *out_formats[] = { "text", "json", "csv" };
+int out_format = OUT_TEXT;
+char *out_file;
+FILE *out_fp;
+int out_runs = 0;
 
 struct thread_info {
     pthread_t thread_id;
@@ -31,9 +189,24 @@ struct thread_info {
     pid_t tid;
     suseconds_t usec_fill;
     suseconds_t usec_leak;
+    struct hist hist;   /* ns of each madvise/munmap call */
+    struct hist fault;  /* ns of the first touch of each page */
+    char *scratch;      /* mremap destination */
+    int node;           /* the node pages live on, for migrate/mbind */
+    int rate;           /* ops/s of an initiator in victim mode */
+    int bystander;      /* no flush, just stay on the CPU */
+    pid_t spinner;      /* the other process spinning on the CPU of a bystander */
+    pthread_mutex_t lock;   /* daemon mode: the reporter takes hist periodically */
     int ret;
 };
 
+struct victim_info {
+    pthread_t thread_id;
+    int core_id;
+    unsigned long stolen_ns;
+    struct hist hist;   /* ns of each gap longer than gap_ns */
+};
+
 
 inline pid_t __gettid()
 {
@@ -45,12 +218,494 @@ inline suseconds_t __time_diff(struct timeval *start, struct timeval *end)
     return (end->tv_sec - start->tv_sec) * 1000 * 1000 + end->tv_usec - start->tv_usec;
 }
 
+/* not adjusted by NTP, cheap enough(vDSO) to time each call */
+inline unsigned long __now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return ts.tv_sec * 1000 * 1000 * 1000 + ts.tv_nsec;
+}
+
+/* TSC ticks per ns, victims use rdtsc to keep the sampling loop tight */
+void __calibrate_tsc()
+{
+    unsigned long ns = __now_ns(), tsc = ins_rdtsc();
+
+    usleep(100 * 1000);
+    tsc_per_ns = (double)(ins_rdtsc() - tsc) / (__now_ns() - ns);
+}
+
+void __bind_core(int core_id)
+{
+    cpu_set_t cpuset;
+    int ret;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(core_id, &cpuset);
+
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if (ret != 0) {
+        print_err_and_exit(ret, "pthread_setaffinity_np");
+    }
+}
+
+void __report_hist(const char *tag, struct hist *h)
+{
+    printf("%s: calls = %ld, average = %ld, p50 = %ld, p90 = %ld, p99 = %ld, max = %ld ns\n",
+            tag, h->total, hist_avg(h), hist_percentile(h, 50), hist_percentile(h, 90),
+            hist_percentile(h, 99), h->max);
+}
+
+/* size with optional K/M/G suffix */
+unsigned long __parse_size(const char *str)
+{
+    char *end;
+    unsigned long size = strtoul(str, &end, 0);
+
+    switch (*end) {
+        case 'G': case 'g':
+            size <<= 10;
+        case 'M': case 'm':
+            size <<= 10;
+        case 'K': case 'k':
+            size <<= 10;
+    }
+
+    return size;
+}
+
+/* whole mapping pages, but a THP range may split the huge page down to 4K */
+unsigned long __round_range(unsigned long size)
+{
+    unsigned long unit = map_mode == MAP_THP ? PAGE_4K : map_page_size;
+
+    if (size < unit)
+        return unit;
+
+    return (size + unit - 1) & ~(unit - 1);
+}
+
+/* buf_size of the selected backing, NULL on failure */
+char *__alloc_buf()
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    unsigned long head;
+    char *p;
+
+    switch (map_mode) {
+        case MAP_2M:
+            flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+            break;
+
+        case MAP_1G:
+            flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+            break;
+
+        case MAP_THP:
+            /* over allocate, trim to a 2M aligned range so every 2M can be a huge page */
+            p = (char*)mmap(NULL, buf_size + PAGE_2M, PROT_READ | PROT_WRITE, flags, -1, 0);
+            if (p == MAP_FAILED)
+                return NULL;
+
+            head = PAGE_2M - ((unsigned long)p & (PAGE_2M - 1));
+            munmap(p, head);
+            munmap(p + head + buf_size, PAGE_2M - head);
+            p += head;
+            if (madvise(p, buf_size, MADV_HUGEPAGE))
+                perror("madvise MADV_HUGEPAGE");
+
+            return p;
+    }
+
+    p = (char*)mmap(NULL, buf_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* one process_madvise() call carries up to IOV_BATCH ranges */
+int __process_madvise_all(struct thread_info *thread_info, char *p)
+{
+    struct iovec iov[IOV_BATCH];
+    unsigned long index = 0, call;
+    long ret;
+    int n;
+
+    while (index < buf_size) {
+        for (n = 0; (n < IOV_BATCH) && (index < buf_size); n++, index += range_size) {
+            iov[n].iov_base = p + index;
+            iov[n].iov_len = buf_size - index < range_size ? buf_size - index : range_size;
+        }
+
+        call = __now_ns();
+        ret = syscall(__NR_process_madvise, pidfd, iov, n, pmadv_advice, 0);
+        hist_add(&thread_info->hist, __now_ns() - call);
+        if (ret < 0) {
+            perror("process_madvise");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* sum of the "TLB:" line of /proc/interrupts, the TLB shootdown IPIs received by all the CPUs */
+unsigned long __tlb_ipis()
+{
+    char line[8192], *pos, *end;
+    unsigned long sum = 0, val;
+    FILE *fp;
+
+    fp = fopen("/proc/interrupts", "r");
+    if (!fp)
+        return 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        pos = line + strspn(line, " ");
+        if (strncmp(pos, "TLB:", 4))
+            continue;
+
+        for (pos += 4; ; pos = end) {
+            val = strtoul(pos, &end, 10);
+            if (end == pos)
+                break;
+            sum += val;
+        }
+        break;
+    }
+
+    fclose(fp);
+
+    return sum;
+}
+
+/* the first number of a sysfs file, or of a CPU list like "0-3,8" */
+int __read_sysfs_int(const char *fmt, int cpu)
+{
+    char path[256];
+    FILE *fp;
+    int val = -1;
+
+    snprintf(path, sizeof(path), fmt, cpu);
+    fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+
+    if (fscanf(fp, "%d", &val) != 1)
+        val = -1;
+    fclose(fp);
+
+    return val;
+}
+
+/* position of cpu in its thread_siblings_list, like 0-3 or 0,64 */
+int __read_sibling_index(int cpu)
+{
+    char path[256], list[256], *tok, *end;
+    int first, last, index = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    fp = fopen(path, "r");
+    if (!fp)
+        return 0;
+
+    if (!fgets(list, sizeof(list), fp))
+        list[0] = '\0';
+    fclose(fp);
+
+    for (tok = strtok(list, ",\n"); tok; tok = strtok(NULL, ",\n")) {
+        first = last = strtol(tok, &end, 0);
+        if (*end == '-')
+            last = strtol(end + 1, NULL, 0);
+
+        if ((cpu >= first) && (cpu <= last))
+            return index + cpu - first;
+        index += last - first + 1;
+    }
+
+    return 0;
+}
+
+/* the shared CPU list of the highest cache level */
+int __read_llc(int cpu)
+{
+    char path[256];
+    int index, level, llc = cpu, max = 0;
+
+    for (index = 0; index < 8; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%%d/cache/index%d/level", index);
+        level = __read_sysfs_int(path, cpu);
+        if (level < 0)
+            break;
+
+        if (level >= max) {
+            max = level;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%%d/cache/index%d/shared_cpu_list", index);
+            llc = __read_sysfs_int(path, cpu);
+        }
+    }
+
+    return llc < 0 ? cpu : llc;
+}
+
+int place_policy_cmp(const void *a, const void *b)
+{
+    const struct cpu_topo *x = a, *y = b;
+    int keys[2][4], i;
+
+    switch (place_policy) {
+        /* one thread per core first, a package after another */
+        case PLACE_COMPACT:
+            keys[0][0] = x->thread; keys[0][1] = x->package; keys[0][2] = x->core; keys[0][3] = x->cpu;
+            keys[1][0] = y->thread; keys[1][1] = y->package; keys[1][2] = y->core; keys[1][3] = y->cpu;
+            break;
+
+        /* one thread per core first, round robin across packages */
+        case PLACE_SCATTER:
+            keys[0][0] = x->thread; keys[0][1] = x->core; keys[0][2] = x->package; keys[0][3] = x->cpu;
+            keys[1][0] = y->thread; keys[1][1] = y->core; keys[1][2] = y->package; keys[1][3] = y->cpu;
+            break;
+
+        /* fill the SMT siblings of a core before the next core */
+        case PLACE_SMT:
+            keys[0][0] = x->package; keys[0][1] = x->core; keys[0][2] = x->thread; keys[0][3] = x->cpu;
+            keys[1][0] = y->package; keys[1][1] = y->core; keys[1][2] = y->thread; keys[1][3] = y->cpu;
+            break;
+
+        /* one thread per LLC first */
+        case PLACE_LLC:
+            keys[0][0] = x->llc_rank; keys[0][1] = x->llc; keys[0][2] = x->cpu; keys[0][3] = 0;
+            keys[1][0] = y->llc_rank; keys[1][1] = y->llc; keys[1][2] = y->cpu; keys[1][3] = 0;
+            break;
+
+        default:
+            return x->cpu - y->cpu;
+    }
+
+    for (i = 0; i < 4; i++) {
+        if (keys[0][i] != keys[1][i])
+            return keys[0][i] - keys[1][i];
+    }
+
+    return 0;
+}
+
+/* order the CPUs allowed for this process by the placement policy */
+void __init_placement()
+{
+    struct cpu_topo *topo;
+    cpu_set_t cpuset;
+    int cpu, i, j;
+
+    if (sched_getaffinity(0, sizeof(cpuset), &cpuset)) {
+        print_err_and_exit(errno, "sched_getaffinity");
+    }
+
+    num_cpus = CPU_COUNT(&cpuset);
+    topo = calloc(num_cpus, sizeof(struct cpu_topo));
+    placement = calloc(num_cpus, sizeof(int));
+    if (!topo || !placement) {
+        print_err_and_exit(errno, "calloc");
+    }
+
+    for (cpu = 0, i = 0; i < num_cpus; cpu++) {
+        if (!CPU_ISSET(cpu, &cpuset))
+            continue;
+
+        topo[i].cpu = cpu;
+        topo[i].package = __read_sysfs_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        topo[i].core = __read_sysfs_int("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        topo[i].thread = __read_sibling_index(cpu);
+        topo[i].llc = __read_llc(cpu);
+        i++;
+    }
+
+    for (i = 0; i < num_cpus; i++) {
+        for (j = 0; j < i; j++) {
+            if (topo[j].llc == topo[i].llc)
+                topo[i].llc_rank++;
+        }
+    }
+
+    qsort(topo, num_cpus, sizeof(struct cpu_topo), place_policy_cmp);
+    for (i = 0; i < num_cpus; i++)
+        placement[i] = topo[i].cpu;
+
+    /* the even ones of the allowed CPUs first, then the odd ones */
+    if (place_policy == PLACE_INTERLEAVE) {
+        for (i = 0, j = 0; j < num_cpus; j += 2)
+            placement[i++] = topo[j].cpu;
+        for (j = 1; j < num_cpus; j += 2)
+            placement[i++] = topo[j].cpu;
+    }
+
+    free(topo);
+}
+
+int __count_nodes()
+{
+    struct dirent *ent;
+    DIR *dir;
+    int nodes = 0;
+
+    dir = opendir("/sys/devices/system/node");
+    if (!dir)
+        return 1;
+
+    while ((ent = readdir(dir))) {
+        if (!strncmp(ent->d_name, "node", 4) && ent->d_name[4] >= '0' && ent->d_name[4] <= '9')
+            nodes++;
+    }
+    closedir(dir);
+
+    return nodes ? nodes : 1;
+}
+
+/* move the pages of [addr, addr + len) to the next node */
+long __migrate(struct thread_info *thread_info, char *addr, unsigned long len)
+{
+    unsigned long count = (len + map_page_size - 1) / map_page_size, i, call, nodemask;
+    void **pages;
+    int *nodes, *status;
+    long ret;
+
+    thread_info->node = (thread_info->node + 1) % num_nodes;
+    if (trigger == TRIGGER_MBIND) {
+        nodemask = 1UL << thread_info->node;
+        call = __now_ns();
+        ret = syscall(__NR_mbind, addr, len, __MPOL_BIND, &nodemask, sizeof(nodemask) * 8, __MPOL_MF_MOVE);
+        hist_add(&thread_info->hist, __now_ns() - call);
+
+        return ret;
+    }
+
+    pages = calloc(count, sizeof(void *));
+    nodes = calloc(count, sizeof(int));
+    status = calloc(count, sizeof(int));
+    if (!pages || !nodes || !status) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < count; i++) {
+        pages[i] = addr + i * map_page_size;
+        nodes[i] = thread_info->node;
+    }
+
+    call = __now_ns();
+    ret = syscall(__NR_move_pages, 0, count, pages, nodes, status, __MPOL_MF_MOVE);
+    hist_add(&thread_info->hist, __now_ns() - call);
+
+    free(status);
+    free(nodes);
+    free(pages);
+
+    return ret;
+}
+
+/* a PROT_NONE reservation of range_size aligned to the mapping page, the mremap destination */
+void __reserve_scratch(struct thread_info *thread_info)
+{
+    char *p = (char*)mmap(NULL, range_size + map_page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    unsigned long head;
+
+    if (p == MAP_FAILED) {
+        print_err_and_exit(errno, "mmap");
+    }
+
+    /* trim it to the aligned range, so that it's simple to release */
+    head = map_page_size - ((unsigned long)p & (map_page_size - 1));
+    munmap(p, head);
+    thread_info->scratch = p + head;
+    if (head < map_page_size)
+        munmap(thread_info->scratch + range_size, map_page_size - head);
+}
+
+/*
+ * shootdown [addr, addr + len) by the selected trigger, only the operation
+ * itself is timed. the range is restored(writable, at the same address) for
+ * the next fill, the restore is not timed.
+ */
+long __trigger(struct thread_info *thread_info, char *addr, unsigned long len)
+{
+    unsigned long call, index;
+    long ret;
+
+    if ((trigger == TRIGGER_MIGRATE) || (trigger == TRIGGER_MBIND))
+        return __migrate(thread_info, addr, len);
+
+    call = __now_ns();
+    switch (trigger) {
+        case TRIGGER_FREE:
+            ret = madvise(addr, len, MADV_FREE);
+            break;
+
+        case TRIGGER_MPROTECT:
+            ret = mprotect(addr, len, PROT_READ);
+            break;
+
+        case TRIGGER_MREMAP:
+            ret = mremap(addr, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, thread_info->scratch) == MAP_FAILED ? -1 : 0;
+            break;
+
+        case TRIGGER_COW:
+            /* the child shares the pages, each write copies and flushes the old PTE */
+            for (index = 0; index < len; index += map_page_size)
+                *(addr+index) = 1;
+            ret = 0;
+            break;
+
+        default:
+            ret = madvise(addr, len, MADV_DONTNEED);
+            break;
+    }
+    hist_add(&thread_info->hist, __now_ns() - call);
+
+    if (ret)
+        return ret;
+
+    if (trigger == TRIGGER_MPROTECT) {
+        ret = mprotect(addr, len, PROT_READ | PROT_WRITE);
+    } else if (trigger == TRIGGER_MREMAP) {
+        ret = mremap(thread_info->scratch, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, addr) == MAP_FAILED ? -1 : 0;
+        /* fill the hole again, the next MREMAP_FIXED would unmap anything mapped there meanwhile */
+        if (!ret && (mmap(thread_info->scratch, len, PROT_NONE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) == MAP_FAILED))
+            ret = -1;
+    }
+
+    return ret;
+}
+
+/*
+ * fork a child sharing all the pages copy-on-write, it waits to be killed.
+ * a child inherits the fds of the process, so the parent can't rely on a
+ * pipe closing to end it.
+ */
+pid_t __fork_cow()
+{
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        print_err_and_exit(errno, "fork");
+    }
+
+    if (pid == 0) {
+        for (;;)
+            pause();
+    }
+
+    return pid;
+}
+
 void *__routine(void *arg)
 {
     struct thread_info *thread_info = arg;
     const pthread_t pid = pthread_self();
     const int core_id = thread_info->core_id;
     struct timeval start, end;
+    unsigned long call;
     int ret;
 
     TRACE();
@@ -70,31 +725,65 @@ void *__routine(void *arg)
         print_err_and_exit(ret, "pthread_getaffinity_np");
     }
 
-    int index;
-    char *p = (char*)mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    unsigned long index;
+    const int cow = (trigger == TRIGGER_COW) && !use_unmap && !use_process_madvise;
+    char *p = __alloc_buf();
+    if (p == NULL) {
+        /* the other workers would wait on cow_barrier forever */
+        if (cow) {
+            print_err_and_exit(errno, "mmap");
+        }
+        perror("mmap");
+        thread_info->ret = -1;
+        return NULL;
+    }
+
+    /* reserve an aligned destination for mremap */
+    if (trigger == TRIGGER_MREMAP) {
+        __reserve_scratch(thread_info);
+    }
 
     int loop;
     for (loop = 0; loop < bench_loops; loop++) {
         gettimeofday(&start, NULL);
-        for (index = 0; index < buf_size; index += 4096)
+        /* each touch faults one mapping page in */
+        for (index = 0; index < buf_size; index += map_page_size) {
+            call = __now_ns();
             *(p+index) = 0;
+            hist_add(&thread_info->fault, __now_ns() - call);
+        }
 
         gettimeofday(&end, NULL);
         thread_info->usec_fill += __time_diff(&start, &end);
 
+        /* a fork per worker would also copy the pages of the other workers */
+        if (cow) {
+            pthread_barrier_wait(&cow_barrier);
+            if (thread_info == cow_leader)
+                cow_child = __fork_cow();
+            pthread_barrier_wait(&cow_barrier);
+        }
+
         gettimeofday(&start, NULL);
         if (use_unmap) {
+            call = __now_ns();
             ret = munmap(p, buf_size);
+            hist_add(&thread_info->hist, __now_ns() - call);
             if (ret != 0) {
                 print_err_and_exit(ret, "munmap");
             }
             //printf("munmap ret = %d\n", ret);
-            char *p = (char*)mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            p = __alloc_buf();
+            if (p == NULL) {
+                print_err_and_exit(errno, "mmap");
+            }
+        } else if (use_process_madvise) {
+            thread_info->ret = __process_madvise_all(thread_info, p);
         } else {
-            for (index = 0; index < buf_size; index += 4096) {
-                ret = madvise(p+index, 4096, MADV_DONTNEED);
+            for (index = 0; index < buf_size; index += range_size) {
+                ret = __trigger(thread_info, p+index, buf_size - index < range_size ? buf_size - index : range_size);
                 if (ret) {
-                    perror("madvise");
+                    perror(triggers[trigger]);
                     thread_info->ret = ret;
                     break;
                 }
@@ -102,89 +791,1208 @@ void *__routine(void *arg)
         }
         gettimeofday(&end, NULL);
         thread_info->usec_leak += __time_diff(&start, &end);
+
+        if (cow) {
+            pthread_barrier_wait(&cow_barrier);
+            if (thread_info == cow_leader) {
+                kill(cow_child, SIGKILL);
+                waitpid(cow_child, NULL, 0);
+            }
+        }
     }
 
+    /* hugetlb pages are reserved until unmap, give them back for the next run */
+    munmap(p, buf_size);
+    if (thread_info->scratch)
+        munmap(thread_info->scratch, range_size);
 
     return NULL;
 }
 
-void show_help()
-{
-    printf("Usage :\n");
-    printf("\t-l NUM : bench loops\n");
-    printf("\t-n CPUs : bench cpus\n");
-    printf("\t-u : use munmap instead of madvise\n");
-    printf("\t-i : use interleave cpu sequence\n");
-}
-
-int main(int argc, char *argv[])
+/* madvise one page at rate ops/s, the page is written first so there is a TLB entry to flush */
+void *__initiator(void *arg)
 {
-    int opt;
-    int num_threads = 8;
-    suseconds_t fill_elapled = 0, leak_elapled;
+    struct thread_info *thread_info = arg;
+    unsigned long period, next, now, call, index = 0;
+    int rate = thread_info->rate;
+    char *p;
 
-    while ((opt = getopt(argc, argv, "il:n:u")) != -1) {
-        switch (opt) {
-            case 'i':
-                use_interleave = 1;
-                break;
+    __bind_core(thread_info->core_id);
 
-            case 'l':
-                bench_loops = atoi(optarg);
-                break;
+    p = __alloc_buf();
+    if (p == NULL) {
+        perror("mmap");
+        thread_info->ret = -1;
+        return NULL;
+    }
 
-            case 'n':
-                num_threads = atoi(optarg);
-                break;
+    period = rate ? 1000 * 1000 * 1000 / rate : 0;
+    next = __now_ns();
+    while (!stop_run) {
+        if (!rate || (now = __now_ns()) < next)
+            continue;
 
-            case 'u':
-                use_unmap = 1;
-                break;
+        *(p+index) = 0;
+        call = __now_ns();
+        if (madvise(p+index, map_page_size, MADV_DONTNEED)) {
+            perror("madvise");
+            thread_info->ret = -1;
+            break;
         }
+        hist_add(&thread_info->hist, __now_ns() - call);
+
+        index = (index + map_page_size) % buf_size;
+        /* don't burst to catch up after a preemption */
+        next = (next + period < now) ? now : next + period;
     }
 
-    printf("Test %d threads\n", num_threads);
-    if (use_unmap)
-        printf("\tuse_unamp flag = %d\n", use_unmap);
-    if (use_interleave)
-        printf("\tuse_interleave flag = %d\n", use_interleave);
+    munmap(p, buf_size);
 
-    struct thread_info *thread_info = calloc(num_threads, sizeof(struct thread_info));
-    if (thread_info == NULL) {
-        perror("calloc");
-        return 0;
-    }
+    return NULL;
+}
 
-    int tnum;
-    for (tnum = 0; tnum < num_threads; tnum++) {
-        if (use_interleave)
-            thread_info[tnum].core_id = tnum * 2;
-        else
-            thread_info[tnum].core_id = tnum;
-        const int create_result = pthread_create(&thread_info[tnum].thread_id, NULL, __routine, &thread_info[tnum]);
-        if (create_result != 0) {
-            print_err_and_exit(create_result, "pthread_create");
+/* a tight timestamp loop, any gap longer than gap_ns is an interruption */
+void *__victim(void *arg)
+{
+    struct victim_info *victim = arg;
+    unsigned long prev, now, gap, threshold = gap_ns * tsc_per_ns;
+
+    __bind_core(victim->core_id);
+
+    prev = ins_rdtsc();
+    while (!stop_run) {
+        now = ins_rdtsc();
+        gap = now - prev;
+        if (gap > threshold) {
+            hist_add(&victim->hist, gap / tsc_per_ns);
+            victim->stolen_ns += gap / tsc_per_ns;
         }
+        prev = now;
     }
 
-    fill_elapled = 0;
-    leak_elapled = 0;
-    for (tnum = 0; tnum < num_threads; tnum++) {
-        void *res;
-        const int join_result = pthread_join(thread_info[tnum].thread_id, &res);
-        if (join_result != 0) {
-            print_err_and_exit(join_result, "pthread_join");
+    return NULL;
+}
+
+/* hypervisor vendor from CPUID, "none" on bare metal */
+void __hypervisor(char *vendor)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    strcpy(vendor, "none");
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & (1U << 31)))
+        return;
+
+    __cpuid(0x40000000, eax, ebx, ecx, edx);
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &ecx, 4);
+    memcpy(vendor + 8, &edx, 4);
+    vendor[12] = '\0';
+    if (!vendor[0])
+        strcpy(vendor, "unknown");
+}
+
+void __cpu_model(char *model, int len)
+{
+    char line[256], *p;
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+
+    strcpy(model, "unknown");
+    if (fp == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "model name", 10) || !(p = strchr(line, ':')))
+            continue;
+
+        for (p++; *p == ' '; p++)
+            ;
+        p[strcspn(p, "\n")] = '\0';
+        /* no quotes in the records */
+        snprintf(model, len, "%s", p);
+        for (p = model; *p; p++) {
+            if ((*p == '"') || (*p == '\\') || (*p == ','))
+                *p = ' ';
+        }
+        break;
+    }
+    fclose(fp);
+}
+
+/* the text output goes on, to stderr if the records take stdout. records are runs, intervals of the daemon or victim rates */
+int out_begin(const char *records)
+{
+    struct utsname uts;
+    char hypervisor[16], model[128];
+
+    if (out_format == OUT_TEXT)
+        return 0;
+
+    if (out_file) {
+        out_fp = fopen(out_file, "w");
+        if (out_fp == NULL) {
+            perror(out_file);
+            return -1;
+        }
+    } else {
+        out_fp = fdopen(dup(STDOUT_FILENO), "w");
+        fflush(stdout);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+
+    uname(&uts);
+    __hypervisor(hypervisor);
+    __cpu_model(model, sizeof(model));
+
+    if (out_format == OUT_JSON) {
+        fprintf(out_fp, "{\n  \"host\": {\"kernel\": \"%s\", \"machine\": \"%s\", \"cpu\": \"%s\", "
+                "\"cpus\": %d, \"nodes\": %d, \"guest\": %s, \"hypervisor\": \"%s\"},\n",
+                uts.release, uts.machine, model, num_cpus, num_nodes,
+                strcmp(hypervisor, "none") ? "true" : "false", hypervisor);
+        fprintf(out_fp, "  \"config\": {\"loops\": %d, \"buffer\": %ld, \"map\": \"%s\", \"page\": %ld, "
+                "\"op\": \"%s\", \"placement\": \"%s\", \"bystander_pct\": %d, \"daemon_rate\": %d, \"victims\": %d},\n  \"%s\": [",
+                bench_loops, buf_size, map_modes[map_mode], map_page_size,
+                use_unmap ? "munmap" : (use_process_madvise ? "process_madvise" : triggers[trigger]),
+                place_policies[place_policy], bystander_pct, daemon_rate, num_victims, records);
+    } else {
+        fprintf(out_fp, "# host: kernel=%s machine=%s cpu=%s cpus=%d nodes=%d hypervisor=%s\n",
+                uts.release, uts.machine, model, num_cpus, num_nodes, hypervisor);
+        fprintf(out_fp, "# config: loops=%d buffer=%ld map=%s page=%ld placement=%s bystander_pct=%d daemon_rate=%d "
+                "victims=%d\n", bench_loops, buf_size, map_modes[map_mode], map_page_size,
+                place_policies[place_policy], bystander_pct, daemon_rate, num_victims);
+        if (num_victims > 0) {
+            fprintf(out_fp, "rate,initiators,victims,gaps_per_op,stolen_pct,calls,avg_ns,p50_ns,p90_ns,"
+                    "p99_ns,max_ns,stall_calls,stall_avg_ns,stall_p50_ns,stall_p90_ns,stall_p99_ns,stall_max_ns\n");
+            return 0;
+        }
+        if (daemon_rate >= 0) {
+            fprintf(out_fp, "record,time_sec,threads,op,range,calls,avg_ns,p50_ns,p90_ns,p99_ns,max_ns,"
+                    "shootdowns_per_sec,ipis_per_sec\n");
+            return 0;
+        }
+        fprintf(out_fp, "run,procs,threads,bystanders,bystander_mode,op,range,proc,core,tid,ret,"
+                "calls,avg_ns,p50_ns,p90_ns,p99_ns,max_ns,fault_avg_ns,fault_p99_ns,fill_usec,leak_usec,"
+                "pages,ipis,ipis_per_op,pages_per_sec,ns_per_page,shootdowns_per_sec\n");
+    }
+
+    return 0;
+}
+
+void __out_hist_json(const char *name, struct hist *h)
+{
+    fprintf(out_fp, "\"%s\": {\"calls\": %ld, \"avg\": %ld, \"p50\": %ld, \"p90\": %ld, \"p99\": %ld, \"max\": %ld}",
+            name, h->total, hist_avg(h), hist_percentile(h, 50), hist_percentile(h, 90),
+            hist_percentile(h, 99), h->max);
+}
+
+/* one run: the merged result and its workers */
+void out_run(struct result *result, const char *op, struct thread_info *thread_info, int total,
+        struct hist *merged, struct hist *faults)
+{
+    unsigned long pages = bench_loops * (buf_size / map_page_size);
+    struct thread_info *t;
+    int tnum;
+
+    if (out_format == OUT_TEXT)
+        return;
+
+    if (out_format == OUT_JSON) {
+        fprintf(out_fp, "%s\n    {\"procs\": %d, \"threads\": %d, \"bystanders\": %d, \"bystander_mode\": \"%s\", "
+                "\"op\": \"%s\", \"range\": %ld, \"fill_usec\": %ld, \"leak_usec\": %ld, \"pages\": %ld, "
+                "\"ipis\": %ld, \"ipis_per_op\": %.3f, \"pages_per_sec\": %.1f, \"ns_per_page\": %.1f, "
+                "\"shootdowns_per_sec\": %.1f,\n      ", out_runs ? "," : "",
+                result->procs, result->threads, result->bystanders, bystander_modes[result->bystander_mode],
+                op, result->range, result->fill_usec, result->leak_usec, result->pages, result->ipis,
+                result->ipis_per_op, result->pages_per_sec, result->ns_per_page, result->shootdowns_per_sec);
+        __out_hist_json("latency", merged);
+        fprintf(out_fp, ", ");
+        __out_hist_json("fault", faults);
+        fprintf(out_fp, ",\n      \"workers\": [");
+    }
+
+    for (tnum = 0; tnum < total; tnum++) {
+        t = &thread_info[tnum];
+        if (t->bystander)
+            continue;
+
+        if (out_format == OUT_JSON) {
+            fprintf(out_fp, "%s\n        {\"proc\": %d, \"core\": %d, \"tid\": %d, \"ret\": %d, "
+                    "\"fill_usec\": %ld, \"leak_usec\": %ld, \"pages_per_sec\": %.1f, \"ns_per_page\": %.1f, "
+                    "\"shootdowns_per_sec\": %.1f, ", tnum ? "," : "", tnum / result->threads,
+                    t->core_id, t->tid, t->ret, t->usec_fill, t->usec_leak,
+                    t->usec_leak ? pages * 1000000.0 / t->usec_leak : 0.0,
+                    pages ? t->usec_leak * 1000.0 / pages : 0.0,
+                    t->usec_leak ? t->hist.total * 1000000.0 / t->usec_leak : 0.0);
+            __out_hist_json("latency", &t->hist);
+            fprintf(out_fp, ", ");
+            __out_hist_json("fault", &t->fault);
+            fprintf(out_fp, "}");
+        } else {
+            fprintf(out_fp, "%d,%d,%d,%d,%s,%s,%ld,%d,%d,%d,%d,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,,,"
+                    "%.1f,%.1f,%.1f\n", out_runs, result->procs, result->threads, result->bystanders,
+                    bystander_modes[result->bystander_mode], op, result->range, tnum / result->threads,
+                    t->core_id, t->tid, t->ret, t->hist.total, hist_avg(&t->hist), hist_percentile(&t->hist, 50),
+                    hist_percentile(&t->hist, 90), hist_percentile(&t->hist, 99), t->hist.max,
+                    hist_avg(&t->fault), hist_percentile(&t->fault, 99), t->usec_fill, t->usec_leak, pages,
+                    t->usec_leak ? pages * 1000000.0 / t->usec_leak : 0.0,
+                    pages ? t->usec_leak * 1000.0 / pages : 0.0,
+                    t->usec_leak ? t->hist.total * 1000000.0 / t->usec_leak : 0.0);
+        }
+    }
+
+    /* the merged row has no proc/core/tid */
+    if (out_format == OUT_JSON) {
+        fprintf(out_fp, "\n      ]}");
+    } else {
+        fprintf(out_fp, "%d,%d,%d,%d,%s,%s,%ld,,,,,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%.3f,"
+                "%.1f,%.1f,%.1f\n", out_runs, result->procs, result->threads, result->bystanders,
+                bystander_modes[result->bystander_mode], op, result->range, result->calls, result->avg,
+                result->p50, result->p90, result->p99, result->max, hist_avg(faults), hist_percentile(faults, 99),
+                result->fill_usec, result->leak_usec, result->pages, result->ipis, result->ipis_per_op,
+                result->pages_per_sec, result->ns_per_page, result->shootdowns_per_sec);
+    }
+
+    out_runs++;
+    fflush(out_fp);
+}
+
+/* one interval of the daemon, or the total of the whole run */
+void out_interval(const char *record, double sec, int threads, double rate, double ipis_rate, struct hist *h)
+{
+    const char *op = triggers[trigger];
+
+    if (out_format == OUT_TEXT)
+        return;
+
+    if (out_format == OUT_JSON) {
+        fprintf(out_fp, "%s\n    {\"record\": \"%s\", \"time_sec\": %.3f, \"threads\": %d, \"op\": \"%s\", "
+                "\"range\": %ld, \"shootdowns_per_sec\": %.1f, \"ipis_per_sec\": %.1f, ", out_runs ? "," : "",
+                record, sec, threads, op, range_size, rate, ipis_rate);
+        __out_hist_json("latency", h);
+        fprintf(out_fp, "}");
+    } else {
+        fprintf(out_fp, "%s,%.3f,%d,%s,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%.1f,%.1f\n", record, sec, threads, op,
+                range_size, h->total, hist_avg(h), hist_percentile(h, 50), hist_percentile(h, 90),
+                hist_percentile(h, 99), h->max, rate, ipis_rate);
+    }
+
+    out_runs++;
+    fflush(out_fp);
+}
+
+/* one rate of the victim mode, the initiator madvise latency and the victim stalls */
+void out_rate(int rate, int initiators, double stolen_pct, struct hist *merged, struct hist *stalls)
+{
+    double gaps_per_op = merged->total ? (double)stalls->total / merged->total : 0.0;
+
+    if (out_format == OUT_TEXT)
+        return;
+
+    if (out_format == OUT_JSON) {
+        fprintf(out_fp, "%s\n    {\"rate\": %d, \"initiators\": %d, \"victims\": %d, \"gaps_per_op\": %.3f, "
+                "\"stolen_pct\": %.3f, ", out_runs ? "," : "", rate, initiators, num_victims, gaps_per_op, stolen_pct);
+        __out_hist_json("latency", merged);
+        fprintf(out_fp, ", ");
+        __out_hist_json("stall", stalls);
+        fprintf(out_fp, "}");
+    } else {
+        fprintf(out_fp, "%d,%d,%d,%.3f,%.3f,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n", rate,
+                initiators, num_victims, gaps_per_op, stolen_pct, merged->total,
+                hist_avg(merged), hist_percentile(merged, 50), hist_percentile(merged, 90),
+                hist_percentile(merged, 99), merged->max, stalls->total, hist_avg(stalls),
+                hist_percentile(stalls, 50), hist_percentile(stalls, 90), hist_percentile(stalls, 99), stalls->max);
+    }
+
+    out_runs++;
+    fflush(out_fp);
+}
+
+void out_end()
+{
+    if (out_format == OUT_TEXT)
+        return;
+
+    if (out_format == OUT_JSON)
+        fprintf(out_fp, "\n  ]\n}\n");
+    fclose(out_fp);
+}
+
+int victim_bench(int num_threads)
+{
+    struct thread_info *initiators;
+    struct victim_info *victims;
+    struct hist *merged, *stalls;
+    unsigned long ops, stolen;
+    double stolen_pct;
+    int r, tnum, ret;
+
+    initiators = calloc(num_threads, sizeof(struct thread_info));
+    victims = calloc(num_victims, sizeof(struct victim_info));
+    merged = calloc(1, sizeof(struct hist));
+    stalls = calloc(1, sizeof(struct hist));
+    if (!initiators || !victims || !merged || !stalls) {
+        perror("calloc");
+        return -1;
+    }
+
+    __calibrate_tsc();
+    printf("Victim mode: %d initiators, %d victims, %d ms each rate, gap > %ld ns, TSC %.3f GHz\n",
+            num_threads, num_victims, duration_ms, gap_ns, tsc_per_ns);
+
+    for (r = 0; r < num_rates; r++) {
+        memset(initiators, 0, num_threads * sizeof(struct thread_info));
+        memset(victims, 0, num_victims * sizeof(struct victim_info));
+        memset(merged, 0, sizeof(struct hist));
+        memset(stalls, 0, sizeof(struct hist));
+        stop_run = 0;
+
+        /* victims on the CPUs following the initiators */
+        for (tnum = 0; tnum < num_victims; tnum++) {
+            victims[tnum].core_id = placement[num_threads + tnum];
+            ret = pthread_create(&victims[tnum].thread_id, NULL, __victim, &victims[tnum]);
+            if (ret != 0) {
+                print_err_and_exit(ret, "pthread_create");
+            }
+        }
+
+        for (tnum = 0; tnum < num_threads; tnum++) {
+            initiators[tnum].core_id = placement[tnum];
+            initiators[tnum].rate = rates[r];
+            ret = pthread_create(&initiators[tnum].thread_id, NULL, __initiator, &initiators[tnum]);
+            if (ret != 0) {
+                print_err_and_exit(ret, "pthread_create");
+            }
+        }
+
+        usleep(duration_ms * 1000);
+        stop_run = 1;
+
+        for (tnum = 0; tnum < num_threads; tnum++) {
+            pthread_join(initiators[tnum].thread_id, NULL);
+            hist_merge(merged, &initiators[tnum].hist);
+        }
+
+        stolen = 0;
+        for (tnum = 0; tnum < num_victims; tnum++) {
+            pthread_join(victims[tnum].thread_id, NULL);
+            hist_merge(stalls, &victims[tnum].hist);
+            stolen += victims[tnum].stolen_ns;
+        }
+
+        ops = merged->total;
+        stolen_pct = num_victims ? stolen * 100.0 / ((double)duration_ms * 1000 * 1000 * num_victims) : 0.0;
+        printf("rate %d ops/s per initiator: ops = %ld, victim gaps = %ld(%.2f per op), "
+                "stolen = %.3f%% of victim time\n", rates[r], ops, stalls->total,
+                ops ? (double)stalls->total / ops : 0.0, stolen_pct);
+        __report_hist("\tinitiator madvise", merged);
+        __report_hist("\tvictim stall", stalls);
+        out_rate(rates[r], num_threads, stolen_pct, merged, stalls);
+    }
+
+    free(stalls);
+    free(merged);
+    free(victims);
+    free(initiators);
+
+    return 0;
+}
+
+/* rate shootdowns/s by a token bucket, every range is written first so there are TLB entries to flush */
+void *__daemon(void *arg)
+{
+    struct thread_info *thread_info = arg;
+    unsigned long now, last, index = 0, len, i;
+    double tokens = 1, rate = thread_info->rate, burst = rate * DAEMON_BURST_MS / 1000;
+    struct timespec ts;
+    char *p;
+    int ret;
+
+    thread_info->tid = __gettid();
+    __bind_core(thread_info->core_id);
+
+    p = __alloc_buf();
+    if (p == NULL) {
+        perror("mmap");
+        thread_info->ret = -1;
+        return NULL;
+    }
+
+    if (trigger == TRIGGER_MREMAP) {
+        __reserve_scratch(thread_info);
+    }
+
+    if (burst < 1)
+        burst = 1;
+
+    last = __now_ns();
+    while (!stop_run) {
+        /* 0 means no limit */
+        if (rate) {
+            now = __now_ns();
+            tokens += (now - last) * rate / 1000000000;
+            if (tokens > burst)
+                tokens = burst;
+            last = now;
+
+            if (tokens < 1) {
+                now = (1 - tokens) * 1000000000 / rate;
+                if (now > DAEMON_SPIN_NS) {
+                    ts.tv_sec = now / 1000000000;
+                    ts.tv_nsec = now % 1000000000;
+                    nanosleep(&ts, NULL);
+                }
+                continue;
+            }
+            tokens -= 1;
+        }
+
+        len = buf_size - index < range_size ? buf_size - index : range_size;
+        for (i = 0; i < len; i += map_page_size)
+            *(p+index+i) = 0;
+
+        pthread_mutex_lock(&thread_info->lock);
+        ret = __trigger(thread_info, p+index, len);
+        pthread_mutex_unlock(&thread_info->lock);
+        if (ret) {
+            perror(triggers[trigger]);
+            thread_info->ret = ret;
+            break;
+        }
+
+        index = index + len < buf_size ? index + len : 0;
+    }
+
+    munmap(p, buf_size);
+    if (thread_info->scratch)
+        munmap(thread_info->scratch, range_size);
+
+    return NULL;
+}
+
+void __stop(int sig)
+{
+    stop_run = 1;
+}
+
+/* run for duration_ms(0 until SIGINT/SIGTERM), report the achieved rate every report_ms */
+int daemon_bench(int num_threads)
+{
+    struct thread_info *thread_info;
+    struct hist *interval, *all;
+    unsigned long start, now, prev, ipis, prev_ipis, first_ipis, wait;
+    const char *op = triggers[trigger];
+    char tag[128];
+    int tnum, ret;
+
+    if (trigger == TRIGGER_COW) {
+        printf("daemon mode doesn't support %s\n", op);
+        return -1;
+    }
+
+    /* every thread gets 1 shootdown/s at least */
+    if (daemon_rate && (num_threads > daemon_rate))
+        num_threads = daemon_rate;
+
+    thread_info = calloc(num_threads, sizeof(struct thread_info));
+    interval = calloc(1, sizeof(struct hist));
+    all = calloc(1, sizeof(struct hist));
+    if (!thread_info || !interval || !all) {
+        perror("calloc");
+        return -1;
+    }
+
+    stop_run = 0;
+    signal(SIGINT, __stop);
+    signal(SIGTERM, __stop);
+
+    printf("Daemon mode: %d threads, target %d shootdowns/s%s, %s range %ld, %s pages, ",
+            num_threads, daemon_rate, daemon_rate ? "" : "(no limit)", op, range_size, map_modes[map_mode]);
+    if (duration_ms)
+        printf("%d ms\n", duration_ms);
+    else
+        printf("until SIGINT/SIGTERM\n");
+
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        thread_info[tnum].core_id = placement[tnum];
+        /* the remainder goes to the first threads */
+        thread_info[tnum].rate = daemon_rate / num_threads + (tnum < daemon_rate % num_threads);
+        pthread_mutex_init(&thread_info[tnum].lock, NULL);
+        ret = pthread_create(&thread_info[tnum].thread_id, NULL, __daemon, &thread_info[tnum]);
+        if (ret != 0) {
+            print_err_and_exit(ret, "pthread_create");
+        }
+    }
+
+    start = prev = __now_ns();
+    first_ipis = prev_ipis = __tlb_ipis();
+    while (!stop_run) {
+        wait = report_ms * 1000UL;
+        if (duration_ms && (start + duration_ms * 1000000UL - prev) / 1000 < wait)
+            wait = (start + duration_ms * 1000000UL - prev) / 1000;
+        usleep(wait);
+
+        memset(interval, 0, sizeof(struct hist));
+        for (tnum = 0; tnum < num_threads; tnum++) {
+            pthread_mutex_lock(&thread_info[tnum].lock);
+            hist_merge(interval, &thread_info[tnum].hist);
+            memset(&thread_info[tnum].hist, 0, sizeof(struct hist));
+            pthread_mutex_unlock(&thread_info[tnum].lock);
+        }
+        hist_merge(all, interval);
+
+        now = __now_ns();
+        ipis = __tlb_ipis();
+        snprintf(tag, sizeof(tag), "%8.1f s: %.1f shootdowns/s, %.1f IPIs/s, %s", (now - start) / 1e9,
+                interval->total * 1e9 / (now - prev), (ipis - prev_ipis) * 1e9 / (now - prev), op);
+        __report_hist(tag, interval);
+        out_interval("interval", (now - start) / 1e9, num_threads, interval->total * 1e9 / (now - prev),
+                (ipis - prev_ipis) * 1e9 / (now - prev), interval);
+        fflush(stdout);
+        prev = now;
+        prev_ipis = ipis;
+
+        if (duration_ms && (now - start >= duration_ms * 1000000UL))
+            break;
+    }
+
+    stop_run = 1;
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        pthread_join(thread_info[tnum].thread_id, NULL);
+        if (thread_info[tnum].ret)
+            printf("thread %d failed, ret = %d\n", thread_info[tnum].core_id, thread_info[tnum].ret);
+        pthread_mutex_destroy(&thread_info[tnum].lock);
+    }
+
+    now = __now_ns();
+    ipis = __tlb_ipis();
+    snprintf(tag, sizeof(tag), "total %.1f s: %.1f shootdowns/s(target %d), %.1f IPIs/s, %s", (now - start) / 1e9,
+            all->total * 1e9 / (now - start), daemon_rate, (ipis - first_ipis) * 1e9 / (now - start), op);
+    __report_hist(tag, all);
+    out_interval("total", (now - start) / 1e9, num_threads, all->total * 1e9 / (now - start),
+            (ipis - first_ipis) * 1e9 / (now - start), all);
+
+    free(all);
+    free(interval);
+    free(thread_info);
+
+    return 0;
+}
+
+/* CPU list like 0-3,8, run the threads on these CPUs instead of the placement policy */
+int __parse_cpus(const char *list)
+{
+    char *str = strdup(list), *tok, *end;
+    int first, last, cpu, num = 0;
+
+    free(placement);
+    placement = calloc(CPU_SETSIZE, sizeof(int));
+    if (!str || !placement) {
+        print_err_and_exit(errno, "calloc");
+    }
+
+    for (tok = strtok(str, ","); tok; tok = strtok(NULL, ",")) {
+        first = last = strtol(tok, &end, 0);
+        if (*end == '-')
+            last = strtol(end + 1, NULL, 0);
+
+        for (cpu = first; (cpu <= last) && (num < CPU_SETSIZE); cpu++)
+            placement[num++] = cpu;
+    }
+
+    free(str);
+
+    return num;
+}
+
+void show_help()
+{
+    printf("Usage :\n");
+    printf("\t-l NUM : bench loops\n");
+    printf("\t-n CPUs : bench cpus\n");
+    printf("\t-u : use munmap instead of madvise\n");
+    printf("\t-i : use interleave cpu sequence(the even ones of the allowed CPUs, then the odd ones), same as -p interleave\n");
+    printf("\t-p POLICY : thread placement linear(default), interleave, compact(one per core, package by package),\n"
+            "\t            scatter(one per core, across packages), smt(siblings of a core together), llc(one per LLC first)\n");
+    printf("\t-M NUM : run NUM processes(one mm each) of -n threads each\n");
+    printf("\t-C : split -n threads into 1, 2, 4 ... processes, compare sharing one mm with one mm each\n");
+    printf("\t-N : sweep thread count 1, 2, 4 ... all the allowed CPUs, and print a scaling table\n");
+    printf("\t-v NUM : victim mode, NUM victim threads record the time stolen by the shootdowns\n");
+    printf("\t-r RATES : madvise ops/s of each initiator in victim mode, default 0,1000,10000,100000\n");
+    printf("\t-t MS : duration of each rate in victim mode, or of the daemon mode(0 runs until SIGINT/SIGTERM), default 1000\n");
+    printf("\t-g NS : gaps longer than NS count as stalls in victim mode, default 500\n");
+    printf("\t-s SIZES : madvise range size of each call, K/M/G suffix allowed, default 4K\n");
+    printf("\t-S : sweep range size from 4K to the whole buffer\n");
+    printf("\t-m MODE : buffer backed by 4k(default), thp, 2m(hugetlb) or 1g(hugetlb) pages\n");
+    printf("\t-b SIZE : buffer size, K/M/G suffix allowed, default 256M\n");
+    printf("\t-o OP : shootdown by dontneed(default), free, mprotect, mremap, migrate(move_pages), mbind or cow(fork+write)\n");
+    printf("\t-f PCT : PCT%% of the threads of each process are bystanders, they don't flush but stay on their CPUs\n");
+    printf("\t-w MODES : bystanders keep busy in the same mm, sleep(idle CPU, lazy TLB) or sleep while\n"
+            "\t           other(another process) spins on the CPU, default sleep, comma separated or all\n");
+    printf("\t-D RATE : daemon mode, sustain RATE shootdowns/s in total(0 means no limit) for -t MS\n");
+    printf("\t-I MS : report the achieved rate and latency every MS in daemon mode, default 1000\n");
+    printf("\t-c CPUS : run the threads on CPU list like 0-3,8, one thread per CPU, instead of -n and -p\n");
+    printf("\t-O FORMAT : also write the results(or the daemon intervals, the victim rates) as json or csv, the text output goes to stderr without -F\n");
+    printf("\t-F FILE : write the json or csv results to FILE instead of stdout\n");
+    printf("\t-P : batch the ranges by process_madvise(), up to 1024 ranges per call\n");
+}
+
+/* pidfd of self for process_madvise(), and pick the advice this kernel accepts */
+int __process_madvise_init()
+{
+    struct iovec iov;
+    char *p;
+
+    pidfd = syscall(__NR_pidfd_open, getpid(), 0);
+    if (pidfd < 0) {
+        perror("pidfd_open");
+        return -1;
+    }
+
+    p = (char*)mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    *p = 0;
+    iov.iov_base = p;
+    iov.iov_len = 4096;
+    if (syscall(__NR_process_madvise, pidfd, &iov, 1, MADV_DONTNEED, 0) < 0) {
+        if (errno != EINVAL) {
+            perror("process_madvise");
+            return -1;
+        }
+
+        printf("process_madvise refuses MADV_DONTNEED, use MADV_PAGEOUT instead\n");
+        pmadv_advice = MADV_PAGEOUT;
+    }
+    munmap(p, 4096);
+
+    return 0;
+}
+
+/* stay on the CPU until the workers of this process finish */
+void *__bystander(void *arg)
+{
+    struct thread_info *thread_info = arg;
+    char c;
+
+    thread_info->tid = __gettid();
+    __bind_core(thread_info->core_id);
+
+    if (bystander_mode == BYSTANDER_BUSY) {
+        while (!stop_run)
+            ;
+    } else {
+        /* the write end is closed at the end */
+        while (read(bystander_pipe[0], &c, 1) < 0 && errno == EINTR)
+            ;
+    }
+
+    return NULL;
+}
+
+/* fork it before the buffers get filled, a big mm is slow to fork and the fork flushes */
+pid_t __fork_spinner(int core_id)
+{
+    cpu_set_t cpuset;
+    pid_t pid = fork();
+
+    if (pid < 0) {
+        print_err_and_exit(errno, "fork");
+    }
+
+    if (pid == 0) {
+        CPU_ZERO(&cpuset);
+        CPU_SET(core_id, &cpuset);
+        sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+        for (;;)
+            ;
+    }
+
+    return pid;
+}
+
+/* create the threads of one process, and wait for them */
+void __run_threads(struct thread_info *thread_info, int num_threads)
+{
+    int tnum, workers = 0;
+
+    /* before the pipe, a spinner holding the write end blocks the bystanders forever */
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        if (thread_info[tnum].bystander && (bystander_mode == BYSTANDER_OTHER))
+            thread_info[tnum].spinner = __fork_spinner(thread_info[tnum].core_id);
+    }
+
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        if (thread_info[tnum].bystander)
+            continue;
+        if (!workers++)
+            cow_leader = &thread_info[tnum];
+    }
+    pthread_barrier_init(&cow_barrier, NULL, workers);
+
+    stop_run = 0;
+    if (pipe(bystander_pipe)) {
+        print_err_and_exit(errno, "pipe");
+    }
+
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        const int create_result = pthread_create(&thread_info[tnum].thread_id, NULL,
+                thread_info[tnum].bystander ? __bystander : __routine, &thread_info[tnum]);
+        if (create_result != 0) {
+            print_err_and_exit(create_result, "pthread_create");
+        }
+    }
+
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        void *res;
+        if (thread_info[tnum].bystander)
+            continue;
+
+        const int join_result = pthread_join(thread_info[tnum].thread_id, &res);
+        if (join_result != 0) {
+            print_err_and_exit(join_result, "pthread_join");
+        }
+        free(res);
+    }
+
+    stop_run = 1;
+    close(bystander_pipe[1]);
+    for (tnum = 0; tnum < num_threads; tnum++) {
+        if (!thread_info[tnum].bystander)
+            continue;
+
+        pthread_join(thread_info[tnum].thread_id, NULL);
+        if (thread_info[tnum].spinner) {
+            kill(thread_info[tnum].spinner, SIGKILL);
+            waitpid(thread_info[tnum].spinner, NULL, 0);
+        }
+    }
+    close(bystander_pipe[0]);
+    pthread_barrier_destroy(&cow_barrier);
+}
+
+/*
+ * num_procs processes x num_threads threads. every process has its own mm,
+ * a shootdown only targets the CPUs running the threads of the same process.
+ * thread_info is shared, so that the children report back to the parent.
+ */
+int run_bench(int num_procs, int num_threads, struct result *result)
+{
+    suseconds_t fill_elapled = 0, leak_elapled;
+    struct hist *merged, *faults;
+    char tag[64];
+    const char *op = use_unmap ? "munmap" : (use_process_madvise ? "process_madvise" : triggers[trigger]);
+    unsigned long ipis = __tlb_ipis(), ops, pages;
+    int total = num_procs * num_threads, proc, workers, failed;
+    int bystanders = num_threads * bystander_pct / 100;
+    pid_t pid;
+
+    /* one worker at least */
+    if (bystanders >= num_threads)
+        bystanders = num_threads - 1;
+
+    printf("Test %d processes x %d threads\n", num_procs, num_threads);
+    if (use_unmap)
+        printf("\tuse_unamp flag = %d\n", use_unmap);
+    printf("\tplacement = %s\n", place_policies[place_policy]);
+    if (!use_unmap)
+        printf("\trange size = %ld, %s\n", range_size, op);
+    printf("\tbuffer %ld MB, %s pages\n", buf_size >> 20, map_modes[map_mode]);
+    if (bystanders)
+        printf("\tbystanders = %d of %d threads per process, %s\n", bystanders, num_threads,
+                bystander_modes[bystander_mode]);
+
+    struct thread_info *thread_info = mmap(NULL, total * sizeof(struct thread_info), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (thread_info == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    int tnum;
+    /* the last threads of each process are the bystanders */
+    for (tnum = 0; tnum < total; tnum++) {
+        thread_info[tnum].core_id = placement[tnum];
+        thread_info[tnum].bystander = tnum % num_threads >= num_threads - bystanders;
+    }
+
+    if (num_procs == 1) {
+        __run_threads(thread_info, num_threads);
+    } else {
+        fflush(stdout);
+        if (out_fp)
+            fflush(out_fp);
+        for (proc = 0; proc < num_procs; proc++) {
+            pid = fork();
+            if (pid < 0) {
+                print_err_and_exit(errno, "fork");
+            }
+
+            if (pid == 0) {
+                /* the inherited pidfd is the parent's, process_madvise() refuses another mm */
+                if (use_process_madvise) {
+                    close(pidfd);
+                    pidfd = syscall(__NR_pidfd_open, getpid(), 0);
+                    if (pidfd < 0)
+                        perror("pidfd_open");
+                }
+                __run_threads(&thread_info[proc * num_threads], num_threads);
+                _exit(0);
+            }
+        }
+
+        for (proc = 0; proc < num_procs; proc++)
+            wait(NULL);
+    }
+
+    merged = calloc(1, sizeof(struct hist));
+    faults = calloc(1, sizeof(struct hist));
+    if (merged == NULL || faults == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    fill_elapled = 0;
+    leak_elapled = 0;
+    failed = 0;
+    for (tnum = 0; tnum < total; tnum++) {
+        if (thread_info[tnum].bystander) {
+            printf("Joined with bystander %d; tid %d\n", thread_info[tnum].core_id, thread_info[tnum].tid);
+            continue;
         }
 
         printf("Joined with thread %d; tid %d, ret = %d\n", thread_info[tnum].core_id, thread_info[tnum].tid, thread_info[tnum].ret);
+        if (thread_info[tnum].ret)
+            failed++;
         fill_elapled += thread_info[tnum].usec_fill;
         leak_elapled += thread_info[tnum].usec_leak;
-        free(res);
+        snprintf(tag, sizeof(tag), "thread %d %s", thread_info[tnum].core_id, op);
+        __report_hist(tag, &thread_info[tnum].hist);
+        hist_merge(merged, &thread_info[tnum].hist);
+        snprintf(tag, sizeof(tag), "thread %d %s fault", thread_info[tnum].core_id, map_modes[map_mode]);
+        __report_hist(tag, &thread_info[tnum].fault);
+        hist_merge(faults, &thread_info[tnum].fault);
     }
 
+    ipis = __tlb_ipis() - ipis;
+
+    /* a failed worker stops early, its numbers mean nothing */
+    if (failed) {
+        printf("%d threads failed, skip the results\n", failed);
+        free(faults);
+        free(merged);
+        munmap(thread_info, total * sizeof(struct thread_info));
+        return -1;
+    }
+
+    ops = merged->total;
+    workers = total - bystanders * num_procs;
+    pages = workers * bench_loops * (buf_size / map_page_size);
     printf("fill_elapled %ld usec, leak_elapled %ld usec\n", fill_elapled, leak_elapled);
+    printf("TLB shootdown IPIs = %ld, %.2f per op\n", ipis, ops ? (double)ipis / ops : 0.0);
+    snprintf(tag, sizeof(tag), "merged %s %s range %ld", map_modes[map_mode], op, range_size);
+    __report_hist(tag, merged);
+    snprintf(tag, sizeof(tag), "merged %s fault", map_modes[map_mode]);
+    __report_hist(tag, faults);
 
-    free(thread_info);
+    result->procs = num_procs;
+    result->threads = num_threads;
+    result->bystanders = bystanders;
+    result->bystander_mode = bystander_mode;
+    result->range = range_size;
+    result->calls = merged->total;
+    result->avg = hist_avg(merged);
+    result->p50 = hist_percentile(merged, 50);
+    result->p90 = hist_percentile(merged, 90);
+    result->p99 = hist_percentile(merged, 99);
+    result->max = merged->max;
+    result->ipis = ipis;
+    result->ipis_per_op = ops ? (double)ipis / ops : 0.0;
+    result->fill_usec = fill_elapled;
+    result->leak_usec = leak_elapled;
+    result->pages = pages;
+    /* leak_elapled sums the workers running in parallel, the average of them is the wall time */
+    result->pages_per_sec = leak_elapled ? pages * 1000000.0 * workers / leak_elapled : 0.0;
+    result->ns_per_page = pages ? leak_elapled * 1000.0 / pages : 0.0;
+    result->shootdowns_per_sec = leak_elapled ? ops * 1000000.0 * workers / leak_elapled : 0.0;
+    printf("pages/s = %.1f, ns/page = %.1f, shootdowns/s = %.1f\n", result->pages_per_sec,
+            result->ns_per_page, result->shootdowns_per_sec);
+    out_run(result, op, thread_info, total, merged, faults);
+
+    free(faults);
+    free(merged);
+    munmap(thread_info, total * sizeof(struct thread_info));
     return 0;
 }
 
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int num_threads = 8;
+    unsigned long size;
+    char *rate;
+    int i, j, k, sweep = 0, thread_sweep = 0;
+    int num_procs = 1, proc_sweep = 0;
+    int proc_counts[64], thread_counts[64], num_thread_counts = 0;
+    struct result *results;
+    int num_results = 0;
+    char tag[32];
+
+    while ((opt = getopt(argc, argv, "b:Cc:D:F:f:g:hI:il:M:m:Nn:O:o:p:Pr:s:St:uv:w:")) != -1) {
+        switch (opt) {
+            case 'b':
+                buf_size = __parse_size(optarg);
+                break;
+
+            case 'c':
+                cpu_list = optarg;
+                break;
+
+            case 'D':
+                daemon_rate = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            case 'I':
+                report_ms = atoi(optarg) > 0 ? atoi(optarg) : 1000;
+                break;
+
+            case 'F':
+                out_file = optarg;
+                break;
+
+            case 'O':
+                for (i = 0; i < sizeof(out_formats) / sizeof(out_formats[0]); i++) {
+                    if (!strcmp(optarg, out_formats[i]))
+                        out_format = i;
+                }
+                break;
+
+            case 'f':
+                bystander_pct = atoi(optarg);
+                break;
+
+            case 'g':
+                gap_ns = atol(optarg);
+                break;
+
+            case 'h':
+                show_help();
+                return 0;
+
+            case 'i':
+                place_policy = PLACE_INTERLEAVE;
+                break;
+
+            case 'l':
+                bench_loops = atoi(optarg);
+                break;
+
+            case 'm':
+                for (i = 0; i < sizeof(map_modes) / sizeof(map_modes[0]); i++) {
+                    if (!strcmp(optarg, map_modes[i]))
+                        map_mode = i;
+                }
+                break;
+
+            case 'n':
+                num_threads = atoi(optarg);
+                break;
+
+            case 'o':
+                for (i = 0; i < sizeof(triggers) / sizeof(triggers[0]); i++) {
+                    if (!strcmp(optarg, triggers[i]))
+                        trigger = i;
+                }
+                break;
+
+            case 'p':
+                for (i = 0; i < sizeof(place_policies) / sizeof(place_policies[0]); i++) {
+                    if (!strcmp(optarg, place_policies[i]))
+                        place_policy = i;
+                }
+                break;
+
+            case 'N':
+                thread_sweep = 1;
+                break;
+
+            case 'M':
+                num_procs = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+
+            case 'C':
+                proc_sweep = 1;
+                break;
+
+            case 'P':
+                use_process_madvise = 1;
+                break;
+
+            case 'r':
+                num_rates = 0;
+                for (rate = strtok(optarg, ","); rate && num_rates < 16; rate = strtok(NULL, ","))
+                    rates[num_rates++] = atoi(rate);
+                break;
+
+            case 's':
+                num_range_sizes = 0;
+                for (rate = strtok(optarg, ","); rate && num_range_sizes < 64; rate = strtok(NULL, ","))
+                    range_sizes[num_range_sizes++] = __parse_size(rate);
+                break;
+
+            case 'S':
+                sweep = 1;
+                break;
+
+            case 't':
+                duration_ms = atoi(optarg);
+                break;
+
+            case 'u':
+                use_unmap = 1;
+                break;
+
+            case 'v':
+                num_victims = atoi(optarg);
+                break;
+
+            case 'w':
+                num_bystander_list = 0;
+                for (rate = strtok(optarg, ","); rate && num_bystander_list < 3; rate = strtok(NULL, ",")) {
+                    for (i = 0; i < sizeof(bystander_modes) / sizeof(bystander_modes[0]); i++) {
+                        if (!strcmp(rate, "all") || !strcmp(rate, bystander_modes[i]))
+                            bystander_list[num_bystander_list++] = i;
+                    }
+                }
+                if (!num_bystander_list)
+                    bystander_list[num_bystander_list++] = BYSTANDER_SLEEP;
+                break;
+        }
+    }
+
+    /* the buffer is in units of mapping pages */
+    map_page_size = map_mode == MAP_1G ? PAGE_1G : (map_mode == MAP_4K ? PAGE_4K : PAGE_2M);
+    buf_size = (buf_size + map_page_size - 1) & ~(map_page_size - 1);
+    range_size = __round_range(range_size);
+    for (i = 0; i < num_range_sizes; i++)
+        range_sizes[i] = __round_range(range_sizes[i]);
+
+    __init_placement();
+    if (cpu_list) {
+        num_cpus = __parse_cpus(cpu_list);
+        num_threads = (num_cpus - num_victims) / num_procs;
+    }
+
+    if (num_victims >= num_cpus) {
+        printf("only %d CPUs allowed, %d victims requested\n", num_cpus, num_victims);
+        return 0;
+    }
+
+    /* -N sweeps its own thread counts, the victim and the daemon mode run -n threads */
+    if ((!thread_sweep || (num_victims > 0) || (daemon_rate >= 0))
+            && (num_procs * num_threads + num_victims > num_cpus)) {
+        printf("only %d CPUs allowed, run %d threads instead of %d\n", num_cpus,
+                (num_cpus - num_victims) / num_procs, num_threads);
+        num_threads = (num_cpus - num_victims) / num_procs;
+        if (num_threads == 0) {
+            printf("too many processes\n");
+            return 0;
+        }
+    }
+
+    num_nodes = __count_nodes();
+    if (num_victims > 0) {
+        if (out_begin("rates"))
+            return 0;
+
+        victim_bench(num_threads);
+        out_end();
+        return 0;
+    }
+
+    if (((trigger == TRIGGER_MIGRATE) || (trigger == TRIGGER_MBIND)) && (num_nodes < 2)) {
+        printf("%s needs 2 NUMA nodes at least\n", triggers[trigger]);
+        return 0;
+    }
+
+    if (daemon_rate >= 0) {
+        if (out_begin("intervals"))
+            return 0;
+
+        daemon_bench(num_threads);
+        out_end();
+        return 0;
+    }
+
+    if (use_process_madvise && __process_madvise_init())
+        return 0;
+
+    /* the kernel flushes the whole TLB above tlb_single_page_flush_ceiling(33 pages by default) */
+    if (sweep) {
+        num_range_sizes = 0;
+        for (size = __round_range(PAGE_4K); size <= buf_size && num_range_sizes < 64; size <<= 1)
+            range_sizes[num_range_sizes++] = size;
+    }
+
+    if (!num_range_sizes)
+        range_sizes[num_range_sizes++] = range_size;
+
+    /* 1, 2, 4 ... up to all the allowed CPUs */
+    if (thread_sweep) {
+        for (i = 1; i < num_cpus / num_procs && num_thread_counts < 63; i <<= 1) {
+            proc_counts[num_thread_counts] = num_procs;
+            thread_counts[num_thread_counts++] = i;
+        }
+        proc_counts[num_thread_counts] = num_procs;
+        thread_counts[num_thread_counts++] = num_cpus / num_procs;
+    } else if (proc_sweep) {
+        /* the same number of workers, from all sharing one mm to one mm each */
+        for (i = 1; i <= num_threads && num_thread_counts < 64; i <<= 1) {
+            if (num_threads % i)
+                continue;
+            proc_counts[num_thread_counts] = i;
+            thread_counts[num_thread_counts++] = num_threads / i;
+        }
+    } else {
+        proc_counts[num_thread_counts] = num_procs;
+        thread_counts[num_thread_counts++] = num_threads;
+    }
+
+    /* the bystander mode makes no difference without bystanders */
+    if (!bystander_pct)
+        num_bystander_list = 1;
+
+    results = calloc(num_thread_counts * num_range_sizes * num_bystander_list, sizeof(struct result));
+    if (results == NULL) {
+        perror("calloc");
+        return 0;
+    }
+
+    if (out_begin("runs"))
+        return 0;
+
+    for (i = 0; i < num_thread_counts; i++) {
+        for (j = 0; j < num_range_sizes; j++) {
+            for (k = 0; k < num_bystander_list; k++) {
+                range_size = range_sizes[j];
+                bystander_mode = bystander_list[k];
+                if (!run_bench(proc_counts[i], thread_counts[i], &results[num_results]))
+                    num_results++;
+            }
+        }
+    }
+
+    if (num_results > 1) {
+        printf("\n%6s %8s %12s %12s %10s %10s %10s %10s %10s %10s\n", "procs", "threads", "bystanders", "range",
+                "calls", "avg(ns)", "p50(ns)", "p99(ns)", "max(ns)", "IPIs/op");
+        for (i = 0; i < num_results; i++) {
+            snprintf(tag, sizeof(tag), "%d %s", results[i].bystanders, results[i].bystanders ?
+                    bystander_modes[results[i].bystander_mode] : "");
+            printf("%6d %8d %12s %12ld %10ld %10ld %10ld %10ld %10ld %10.2f\n", results[i].procs, results[i].threads, tag, results[i].range,
+                    results[i].calls, results[i].avg, results[i].p50, results[i].p99, results[i].max,
+                    results[i].ipis_per_op);
+        }
+    }
+
+    out_end();
+    free(results);
+
+    return 0;
+}
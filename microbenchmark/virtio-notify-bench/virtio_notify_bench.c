@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2021 zhenwei pi pizhenwei@bytedance.com.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/pci.h>
+#include <linux/slab.h>
+#include <linux/virtio_pci.h>
+#include "../common/rdtsc.h"
+#include "../common/hist.h"
+#include "../common/parallel.h"
+
+/* benchmark this device only, DDDD:BB:SS.F, default all the virtio-pci devices */
+static char *dev;
+module_param(dev, charp, 0444);
+
+/* the queue to kick, a kick without new buffers is ignored by the device */
+static int queue;
+module_param(queue, int, 0444);
+
+/* run each case on the first cpus=XX CPUs at the same time, 0 means the loading CPU only */
+static int cpus;
+module_param(cpus, int, 0444);
+
+#define LOOP 10000
+#define VIRTIO_PCI_VENDOR	0x1af4
+
+struct notify_target {
+	const char *dev;
+	char *name;
+	void *addr;
+	bool write;
+	u16 val;
+};
+
+static struct hist *h;
+
+static void notify_loop(struct notify_target *t, struct hist *h)
+{
+	unsigned long start;
+	int loop;
+
+	memset(h, 0, sizeof(*h));
+	for (loop = LOOP; loop > 0; loop--) {
+		start = ins_rdtsc();
+		if (t->write)
+			iowrite16(t->val, t->addr);
+		else
+			ioread16(t->addr);
+		hist_add(h, ins_rdtsc() - start);
+	}
+}
+
+static void notify_parallel(struct parallel_worker *pw)
+{
+	notify_loop(pw->arg, &pw->hist);
+}
+
+static void notify_bench(struct notify_target *t)
+{
+	struct parallel_worker *workers;
+	char buf[64];
+	int nr = cpus;
+
+	if (!cpus) {
+		notify_loop(t, h);
+		printk(KERN_INFO "virtio_notify_bench: %s %-18s loop = %d, average = %ld, "
+				"p50 = %ld, p99 = %ld, max = %ld cycles\n", t->dev, t->name, LOOP,
+				hist_avg(h), hist_percentile(h, 50), hist_percentile(h, 99), h->max);
+		return;
+	}
+
+	workers = parallel_run("virtio_notify_bench", &nr, notify_parallel, t);
+	if (!workers)
+		return;
+
+	snprintf(buf, sizeof(buf), "%s %-18s", t->dev, t->name);
+	parallel_report("virtio_notify_bench", buf, workers, nr);
+	vfree(workers);
+}
+
+static void notify_bench_range(struct pci_dev *pdev, char *name, int bar, unsigned long off, bool write)
+{
+	struct notify_target t = { .dev = pci_name(pdev), .name = name, .write = write, .val = queue };
+
+	if (off + 2 > pci_resource_len(pdev, bar)) {
+		printk(KERN_INFO "virtio_notify_bench: %s %s out of BAR%d, skip\n", t.dev, name, bar);
+		return;
+	}
+
+	t.addr = pci_iomap_range(pdev, bar, off, 2);
+	if (!t.addr) {
+		printk(KERN_INFO "virtio_notify_bench: %s map BAR%d failed, skip %s\n", t.dev, bar, name);
+		return;
+	}
+
+	notify_bench(&t);
+	pci_iounmap(pdev, t.addr);
+}
+
+/*
+ * walk the vendor capabilities of a modern device. QEMU may expose more than
+ * one notify region(modern-pio-notify=on adds one in an IO BAR), bench each.
+ * the device driver owns queue_select of the common config, we don't touch
+ * it, queue_notify_off is assumed to be the queue index as QEMU does.
+ */
+static void notify_bench_modern(struct pci_dev *pdev)
+{
+	u8 type, bar;
+	u32 off, mult;
+	int pos;
+
+	for (pos = pci_find_capability(pdev, PCI_CAP_ID_VNDR); pos;
+			pos = pci_find_next_capability(pdev, pos, PCI_CAP_ID_VNDR)) {
+		pci_read_config_byte(pdev, pos + offsetof(struct virtio_pci_cap, cfg_type), &type);
+		pci_read_config_byte(pdev, pos + offsetof(struct virtio_pci_cap, bar), &bar);
+		pci_read_config_dword(pdev, pos + offsetof(struct virtio_pci_cap, offset), &off);
+		if (bar > PCI_STD_RESOURCE_END)
+			continue;
+
+		switch (type) {
+		case VIRTIO_PCI_CAP_COMMON_CFG:
+			/* a plain register emulated by the VMM, compare with the notify */
+			notify_bench_range(pdev, "modern read", bar,
+					off + offsetof(struct virtio_pci_common_cfg, num_queues), false);
+			break;
+
+		case VIRTIO_PCI_CAP_NOTIFY_CFG:
+			pci_read_config_dword(pdev, pos + offsetof(struct virtio_pci_notify_cap,
+						notify_off_multiplier), &mult);
+			notify_bench_range(pdev, pci_resource_flags(pdev, bar) & IORESOURCE_IO ?
+					"modern pio notify" : "modern mmio notify", bar,
+					off + queue * mult, true);
+			break;
+		}
+	}
+}
+
+/* transitional device, BAR0 is the legacy IO region */
+static void notify_bench_legacy(struct pci_dev *pdev)
+{
+	if ((pdev->device < 0x1000) || (pdev->device > 0x103f))
+		return;
+
+	if (!(pci_resource_flags(pdev, 0) & IORESOURCE_IO))
+		return;
+
+	notify_bench_range(pdev, "legacy read", 0, VIRTIO_PCI_HOST_FEATURES, false);
+	notify_bench_range(pdev, "legacy pio notify", 0, VIRTIO_PCI_QUEUE_NOTIFY, true);
+}
+
+static int virtio_notify_bench_init(void)
+{
+	struct pci_dev *pdev = NULL;
+	int found = 0;
+
+	printk(KERN_INFO "virtio_notify_bench: %s start, kick queue %d\n", __func__, queue);
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h) {
+		printk(KERN_INFO "virtio_notify_bench: no enough memory\n");
+		return -1;
+	}
+
+	while ((pdev = pci_get_device(VIRTIO_PCI_VENDOR, PCI_ANY_ID, pdev))) {
+		if (dev && strcmp(dev, pci_name(pdev)))
+			continue;
+
+		printk(KERN_INFO "virtio_notify_bench: %s device id 0x%04x, driver %s\n", pci_name(pdev),
+				pdev->device, pdev->driver ? pdev->driver->name : "none");
+		notify_bench_modern(pdev);
+		notify_bench_legacy(pdev);
+		found++;
+	}
+
+	if (!found)
+		printk(KERN_INFO "virtio_notify_bench: no virtio-pci device found\n");
+
+	kfree(h);
+	printk(KERN_INFO "virtio_notify_bench: %s finish\n", __func__);
+
+	return -1;
+}
+
+static void virtio_notify_bench_exit(void)
+{
+	/* should never run */
+	printk(KERN_INFO "virtio_notify_bench: %s\n", __func__);
+}
+
+module_init(virtio_notify_bench_init);
+module_exit(virtio_notify_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("zhenwei pi pizhewnei@bytedance.com");